@@ -2,6 +2,13 @@
  * FILE: mpi_mm.cpp
  * DESCRIPTION:
  *   MPI implementation of Bitonic Sort with Caliper instrumentation.
+ *   Usage: bitonic_sort <n> [input_type] [stable]
+ *   In stable mode each key carries its global index as a tiebreak (see
+ *   Common/stable_sort.h), packed into an int when the key range allows it,
+ *   otherwise sorted as a 64-bit composite. The indices that come out of the
+ *   sort are checked: equal keys must keep ascending index order. The
+ *   "duplicates" input type (16 distinct keys) exercises that check hardest
+ *   and is small enough for the packed int encoding.
  * AUTHOR:
  *   Ishaan Nigam
  ******************************************************************************/
@@ -15,42 +22,54 @@
 #include <caliper/cali-manager.h>
 #include <adiak.hpp>
 #include <string>
-
-// Comparison function for compare-exchange
-void compare_exchange(int *data1, int *data2, int count, int dir)
+#include <algorithm>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "stable_sort.h"
+#include "buffer_arena.h"
+#include "run_codec.h"
+
+// Merge-split of two ascending blocks of count elements: out receives the
+// count smallest (keep_low) or count largest of their union, ascending
+template <typename T>
+void merge_split(const T *mine, const T *theirs, T *out, long long count, bool keep_low)
 {
-    for (int i = 0; i < count; i++)
+    if (keep_low)
     {
-        if ((dir == 1 && data1[i] > data2[i]) || (dir == 0 && data1[i] < data2[i]))
-        {
-            int temp = data1[i];
-            data1[i] = data2[i];
-            data2[i] = temp;
-        }
+        long long a = 0, b = 0;
+        for (long long i = 0; i < count; i++)
+            out[i] = (b >= count || (a < count && mine[a] <= theirs[b])) ? mine[a++] : theirs[b++];
+    }
+    else
+    {
+        long long a = count - 1, b = count - 1;
+        for (long long i = count - 1; i >= 0; i--)
+            out[i] = (b < 0 || (a >= 0 && mine[a] >= theirs[b])) ? mine[a--] : theirs[b--];
     }
 }
 
 // Local bitonic sort function
-void bitonic_sort_local(int *data, int start, int length, int dir)
+template <typename T>
+void bitonic_sort_local(T *data, long long start, long long length, int dir)
 {
     if (length > 1)
     {
-        int k = length / 2;
+        long long k = length / 2;
         bitonic_sort_local(data, start, k, 1);
         bitonic_sort_local(data, start + k, k, 0);
 
         // Perform bitonic merge
-        int step = k;
+        long long step = k;
         while (step > 0)
         {
-            for (int i = start; i < start + length - step; i++)
+            for (long long i = start; i < start + length - step; i++)
             {
                 if ((i - start) % (2 * step) < step)
                 {
                     if ((dir == 1 && data[i] > data[i + step]) ||
                         (dir == 0 && data[i] < data[i + step]))
                     {
-                        int temp = data[i];
+                        T temp = data[i];
                         data[i] = data[i + step];
                         data[i + step] = temp;
                     }
@@ -62,9 +81,11 @@ void bitonic_sort_local(int *data, int start, int length, int dir)
 }
 
 // MPI Bitonic sort function
-void mpi_bitonic_sort(int *local_data, int local_n, int rank, int size)
+template <typename T>
+void mpi_bitonic_sort(T *local_data, long long local_n, int rank, int size, MPI_Datatype type)
 {
-    int *recv_data = (int *)malloc(local_n * sizeof(int));
+    T *recv_data = (T *)arena_acquire(local_n * sizeof(T));
+    T *merged = (T *)arena_acquire(local_n * sizeof(T));
     int partner;
 
     CALI_MARK_BEGIN("mpi_bitonic_sort");
@@ -73,6 +94,10 @@ void mpi_bitonic_sort(int *local_data, int local_n, int rank, int size)
 
     for (int k = 0; k < logp; k++) // Stages
     {
+        char phase_name[32];
+        snprintf(phase_name, sizeof(phase_name), "bitonic_stage_%d", k);
+        comm_trace_phase(phase_name);
+
         for (int j = k; j >= 0; j--) // Steps within stages
         {
             int mask = 1 << j;
@@ -83,53 +108,40 @@ void mpi_bitonic_sort(int *local_data, int local_n, int rank, int size)
 
             CALI_MARK_BEGIN("comm");
             CALI_MARK_BEGIN("comm_large");
-            MPI_Sendrecv(local_data, local_n, MPI_INT, partner, 0,
-                        recv_data, local_n, MPI_INT, partner, 0,
-                        MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            // Blocks are sorted runs; int keys may go compressed (SORT_COMPRESS)
+            if (type == MPI_INT && run_codec_enabled())
+                compressed_Sendrecv((int *)local_data, local_n, partner, 0,
+                                    (int *)recv_data, partner, 0, MPI_COMM_WORLD);
+            else
+                large_Sendrecv(local_data, local_n, type, partner, 0,
+                            recv_data, partner, 0,
+                            MPI_COMM_WORLD, MPI_STATUS_IGNORE);
             CALI_MARK_END("comm_large");
             CALI_MARK_END("comm");
 
+            // Blocks stay sorted: the lower rank of an ascending pair (or the
+            // higher rank of a descending one) keeps the smaller half
             CALI_MARK_BEGIN("comp_small");
-            if (rank < partner)
-            {
-                if (dir == 1)
-                {
-                    compare_exchange(local_data, recv_data, local_n, dir);
-                }
-                else
-                {
-                    // Keep higher elements
-                    compare_exchange(recv_data, local_data, local_n, dir);
-                }
-            }
-            else
-            {
-                if (dir == 1)
-                {
-                    compare_exchange(recv_data, local_data, local_n, dir);
-                }
-                else
-                {
-                    // Keep higher elements
-                    compare_exchange(local_data, recv_data, local_n, dir);
-                }
-            }
+            bool keep_low = (rank < partner) == (dir == 1);
+            merge_split(local_data, recv_data, merged, local_n, keep_low);
+            std::copy(merged, merged + local_n, local_data);
             CALI_MARK_END("comp_small");
         }
     }
 
     CALI_MARK_END("mpi_bitonic_sort");
 
-    free(recv_data);
+    arena_release(merged);
+    arena_release(recv_data);
 }
 
 int main(int argc, char *argv[])
 {
     int numtasks, rank;
-    int n = 1024; // Default total number of elements
+    long long n = 1024; // Default total number of elements
     int *data = NULL;
     int *local_data;
-    int local_n;
+    long long local_n;
     double start_time, end_time;
 
     // Initialize MPI
@@ -140,13 +152,19 @@ int main(int argc, char *argv[])
     mgr.add("runtime-report");
     mgr.start();
 
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
     // Start main region
     CALI_MARK_BEGIN("main");
 
     // Get command line arguments
     if (argc >= 2)
     {
-        n = atoi(argv[1]);
+        n = atoll(argv[1]);
     }
 
     std::string input_type = "random";
@@ -155,6 +173,8 @@ int main(int argc, char *argv[])
         input_type = argv[2];
     }
 
+    bool stable = argc >= 4 && std::string(argv[3]) == "stable";
+
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &numtasks);
 
@@ -192,7 +212,7 @@ int main(int argc, char *argv[])
         {
             // Random data
             srand(time(NULL));
-            for (int i = 0; i < n; i++)
+            for (long long i = 0; i < n; i++)
             {
                 data[i] = rand() % n;
             }
@@ -200,7 +220,7 @@ int main(int argc, char *argv[])
         else if (input_type == "sorted")
         {
             // Sorted data
-            for (int i = 0; i < n; i++)
+            for (long long i = 0; i < n; i++)
             {
                 data[i] = i;
             }
@@ -208,23 +228,32 @@ int main(int argc, char *argv[])
         else if (input_type == "reverse")
         {
             // Reverse sorted data
-            for (int i = 0; i < n; i++)
+            for (long long i = 0; i < n; i++)
             {
                 data[i] = n - i;
             }
         }
+        else if (input_type == "duplicates")
+        {
+            // Few distinct keys, many ties
+            srand(time(NULL));
+            for (long long i = 0; i < n; i++)
+            {
+                data[i] = rand() % 16;
+            }
+        }
         else if (input_type == "nearly_sorted")
         {
             // Nearly sorted data
-            for (int i = 0; i < n; i++)
+            for (long long i = 0; i < n; i++)
             {
                 data[i] = i;
             }
-            int num_swaps = n / 100; // 1% perturbation
-            for (int i = 0; i < num_swaps; i++)
+            long long num_swaps = n / 100; // 1% perturbation
+            for (long long i = 0; i < num_swaps; i++)
             {
-                int idx1 = rand() % n;
-                int idx2 = rand() % n;
+                long long idx1 = rand() % n;
+                long long idx2 = rand() % n;
                 int temp = data[idx1];
                 data[idx1] = data[idx2];
                 data[idx2] = temp;
@@ -234,7 +263,7 @@ int main(int argc, char *argv[])
         {
             // Default to random
             srand(time(NULL));
-            for (int i = 0; i < n; i++)
+            for (long long i = 0; i < n; i++)
             {
                 data[i] = rand() % n;
             }
@@ -244,9 +273,10 @@ int main(int argc, char *argv[])
     }
 
     // Distribute data to all processes
+    comm_trace_phase("scatter");
     CALI_MARK_BEGIN("comm");
     CALI_MARK_BEGIN("comm_large");
-    MPI_Scatter(data, local_n, MPI_INT, local_data, local_n, MPI_INT, 0, MPI_COMM_WORLD);
+    large_Scatter(data, local_n, MPI_INT, local_data, 0, MPI_COMM_WORLD);
     CALI_MARK_END("comm_large");
     CALI_MARK_END("comm");
 
@@ -254,42 +284,132 @@ int main(int argc, char *argv[])
     MPI_Barrier(MPI_COMM_WORLD);
     start_time = MPI_Wtime();
 
-    // Local bitonic sort
-    CALI_MARK_BEGIN("comp");
-    CALI_MARK_BEGIN("comp_large");
-    bitonic_sort_local(local_data, 0, local_n, 1);
-    CALI_MARK_END("comp_large");
-    CALI_MARK_END("comp");
+    StableKeyCodec codec;
+    std::string key_encoding = "plain";
+    // Global input index of every sorted key (stable mode), for the check
+    long long *sorted_index = NULL;
+    if (stable && !stable_codec_init(codec, local_data, local_n, MPI_COMM_WORLD))
+    {
+        if (rank == 0)
+            printf("Key range and element count do not fit a 64-bit stable key.\n");
+        MPI_Finalize();
+        exit(0);
+    }
 
-    // Perform the MPI bitonic sort
-    mpi_bitonic_sort(local_data, local_n, rank, numtasks);
+    if (!stable)
+    {
+        // Local bitonic sort
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_large");
+        bitonic_sort_local(local_data, 0, local_n, 1);
+        CALI_MARK_END("comp_large");
+        CALI_MARK_END("comp");
+
+        // Perform the MPI bitonic sort
+        mpi_bitonic_sort(local_data, local_n, rank, numtasks, MPI_INT);
+    }
+    else if (codec.packed)
+    {
+        // Key and global index fit in 31 bits: sort the packed ints in place
+        key_encoding = "packed32";
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_large");
+        for (long long i = 0; i < local_n; i++)
+            local_data[i] = stable_pack32(codec, local_data[i], codec.first_index + i);
+        bitonic_sort_local(local_data, 0, local_n, 1);
+        CALI_MARK_END("comp_large");
+        CALI_MARK_END("comp");
+
+        mpi_bitonic_sort(local_data, local_n, rank, numtasks, MPI_INT);
+
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        sorted_index = (long long *)arena_acquire(local_n * sizeof(long long));
+        for (long long i = 0; i < local_n; i++)
+        {
+            sorted_index[i] = stable_index(codec, local_data[i]);
+            local_data[i] = stable_key(codec, local_data[i]);
+        }
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+    }
+    else
+    {
+        // 64-bit composite keys
+        key_encoding = "composite64";
+        long long *wide = (long long *)arena_acquire(local_n * sizeof(long long));
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_large");
+        for (long long i = 0; i < local_n; i++)
+            wide[i] = stable_pack64(codec, local_data[i], codec.first_index + i);
+        bitonic_sort_local(wide, 0, local_n, 1);
+        CALI_MARK_END("comp_large");
+        CALI_MARK_END("comp");
+
+        mpi_bitonic_sort(wide, local_n, rank, numtasks, MPI_LONG_LONG);
+
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        sorted_index = (long long *)arena_acquire(local_n * sizeof(long long));
+        for (long long i = 0; i < local_n; i++)
+        {
+            sorted_index[i] = stable_index(codec, wide[i]);
+            local_data[i] = stable_key(codec, wide[i]);
+        }
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+        arena_release(wide);
+    }
 
     // Synchronize all processes after sorting
     MPI_Barrier(MPI_COMM_WORLD);
     end_time = MPI_Wtime();
 
+    // Equal keys must come out in input order
+    bool stable_ok = true;
+    if (stable)
+    {
+        CALI_MARK_BEGIN("correctness_check");
+        stable_ok = stable_order_check(local_data, sorted_index, local_n, MPI_COMM_WORLD);
+        CALI_MARK_END("correctness_check");
+        arena_release(sorted_index);
+    }
+
     // Gather sorted data
+    comm_trace_phase("gather");
     CALI_MARK_BEGIN("comm");
     CALI_MARK_BEGIN("comm_large");
     if (rank == 0)
     {
-        MPI_Gather(MPI_IN_PLACE, local_n, MPI_INT, data, local_n, MPI_INT, 0, MPI_COMM_WORLD);
+        // In place means rank 0's block must already sit at the front of data
+        std::copy(local_data, local_data + local_n, data);
+        large_Gather(MPI_IN_PLACE, local_n, MPI_INT, data, 0, MPI_COMM_WORLD);
     }
     else
     {
-        MPI_Gather(local_data, local_n, MPI_INT, data, local_n, MPI_INT, 0, MPI_COMM_WORLD);
+        large_Gather(local_data, local_n, MPI_INT, data, 0, MPI_COMM_WORLD);
     }
     CALI_MARK_END("comm_large");
     CALI_MARK_END("comm");
 
     if (rank == 0)
     {
+        printf("Is the sorted array valid? %s\n", std::is_sorted(data, data + local_n * numtasks) ? "Yes" : "No");
+        if (stable)
+        {
+            printf("Stable mode, key encoding: %s\n", key_encoding.c_str());
+            printf("Is the sort stable? %s\n", stable_ok ? "Yes" : "No");
+        }
         printf("Time taken: %f seconds\n", end_time - start_time);
         free(data);
     }
 
     free(local_data);
 
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+    run_codec_finalize(MPI_COMM_WORLD);
+
     // Flush and stop Caliper
     mgr.flush();
     mgr.stop();
@@ -306,6 +426,8 @@ int main(int argc, char *argv[])
     adiak::value("size_of_data_type", sizeof(int)); // Size of data type in bytes
     adiak::value("input_size", n); // Number of elements in input dataset
     adiak::value("input_type", input_type); // Type of input data
+    adiak::value("stable", stable ? 1 : 0); // Equal keys keep their input order
+    adiak::value("key_encoding", key_encoding); // plain, packed32 or composite64
     adiak::value("num_procs", numtasks); // Number of processors (MPI ranks)
     adiak::value("scalability", "strong"); // Scalability type ("strong" or "weak")
     adiak::value("group_num", 21); // Group number
@@ -0,0 +1,321 @@
+/******************************************************************************
+ * FILE: buffer_arena.h
+ * DESCRIPTION:
+ *   Per-rank pool for the sorters' scratch buffers. Blocks that are released
+ *   go back to the pool and are handed out again to the next request of a
+ *   similar size, so a buffer needed once per pass or once per call is mapped
+ *   (and faulted in) only the first time.
+ *
+ *   Large blocks are mmap'ed directly. With SORT_ARENA_HUGEPAGES=1 they are
+ *   backed by 2 MB pages (MAP_HUGETLB if the system has reserved huge pages,
+ *   transparent huge pages otherwise). Every new block is touched page by page
+ *   right after it is mapped so its memory is placed next to the rank that
+ *   owns it and no page faults land in the timed regions; set
+ *   SORT_ARENA_FIRST_TOUCH=0 to skip this.
+ *
+ *   The arena tracks bytes in use per phase; phases follow comm_trace_phase
+ *   (tracing does not need to be enabled). arena_finalize reduces the per-rank
+ *   high-water marks and records them as Caliper globals:
+ *     arena.peak_bytes           max over ranks of bytes in use
+ *     arena.peak_bytes.<phase>   the same, per phase
+ *     arena.mapped_peak_bytes    max over ranks of bytes held by the pool
+ *
+ *   Use arena_acquire/arena_release for raw buffers and arena_vector<T> for
+ *   std::vector storage. arena_raw_vector<T> leaves new elements of trivial
+ *   types uninitialized, for buffers that are written before they are read.
+ ******************************************************************************/
+
+#ifndef BUFFER_ARENA_H
+#define BUFFER_ARENA_H
+
+#include <mpi.h>
+#include <caliper/cali.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <map>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include "comm_trace.h"
+
+#define ARENA_MAX_PHASES 64
+// Requests below this size are served by malloc (still counted)
+#define ARENA_SMALL_BYTES (64 * 1024)
+#define ARENA_HUGE_PAGE_BYTES (2 * 1024 * 1024)
+
+struct ArenaPhase {
+    std::string name;
+    long long peak;        // highest bytes in use while this phase was current
+};
+
+struct BufferArena {
+    bool initialized;
+    bool huge_pages;
+    bool first_touch;
+    long long in_use;      // bytes handed out and not yet released
+    long long mapped;      // bytes of pooled blocks, in use or free
+    long long peak_in_use;
+    long long peak_mapped;
+    long long maps;        // blocks mapped
+    long long reuses;      // requests served from the pool
+    std::multimap<size_t, void *> free_blocks;   // size -> pooled free block
+    std::map<void *, std::pair<size_t, bool> > live;  // block -> (size, pooled)
+    std::vector<ArenaPhase> phases;
+    int current;
+};
+
+inline BufferArena &buffer_arena_state()
+{
+    static BufferArena state;
+    return state;
+}
+
+inline void arena_phase(const char *name)
+{
+    BufferArena &a = buffer_arena_state();
+    for (size_t i = 0; i < a.phases.size(); i++)
+    {
+        if (a.phases[i].name == name)
+        {
+            a.current = (int)i;
+            if (a.in_use > a.phases[i].peak)
+                a.phases[i].peak = a.in_use;
+            return;
+        }
+    }
+    if (a.phases.size() >= ARENA_MAX_PHASES)
+        return;
+    ArenaPhase ph;
+    ph.name = name;
+    ph.peak = a.in_use;
+    a.phases.push_back(ph);
+    a.current = (int)a.phases.size() - 1;
+}
+
+// Reads the SORT_ARENA_* settings and starts following comm_trace phases.
+// Safe to call more than once; the first allocation calls it implicitly.
+inline void arena_init()
+{
+    BufferArena &a = buffer_arena_state();
+    if (a.initialized)
+        return;
+    const char *huge = getenv("SORT_ARENA_HUGEPAGES");
+    const char *touch = getenv("SORT_ARENA_FIRST_TOUCH");
+    a.initialized = true;
+    a.huge_pages = huge != NULL && atoi(huge) != 0;
+    a.first_touch = touch == NULL || atoi(touch) != 0;
+    a.in_use = a.mapped = a.peak_in_use = a.peak_mapped = 0;
+    a.maps = a.reuses = 0;
+    a.current = -1;
+    comm_trace_state().phase_hook = arena_phase;
+}
+
+inline void *arena_map_block(BufferArena &a, size_t bytes)
+{
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (a.huge_pages)
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED)
+    {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        if (a.huge_pages)
+            madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    }
+    if (a.first_touch)
+    {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        for (size_t off = 0; off < bytes; off += page)
+            ((volatile char *)p)[off] = 0;
+    }
+    a.maps++;
+    a.mapped += (long long)bytes;
+    if (a.mapped > a.peak_mapped)
+        a.peak_mapped = a.mapped;
+    return p;
+}
+
+inline void arena_count(BufferArena &a, long long bytes)
+{
+    a.in_use += bytes;
+    if (a.in_use > a.peak_in_use)
+        a.peak_in_use = a.in_use;
+    if (a.current >= 0 && a.in_use > a.phases[a.current].peak)
+        a.phases[a.current].peak = a.in_use;
+}
+
+// Buffer of at least bytes bytes, contents unspecified. Throws
+// std::bad_alloc if the memory cannot be mapped.
+inline void *arena_acquire(size_t bytes)
+{
+    BufferArena &a = buffer_arena_state();
+    arena_init();
+    if (bytes == 0)
+        bytes = 1;
+
+    if (bytes < ARENA_SMALL_BYTES)
+    {
+        void *p = malloc(bytes);
+        if (p == NULL)
+            throw std::bad_alloc();
+        a.live[p] = std::make_pair(bytes, false);
+        arena_count(a, (long long)bytes);
+        return p;
+    }
+
+    size_t unit = a.huge_pages ? ARENA_HUGE_PAGE_BYTES : (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (bytes + unit - 1) / unit * unit;
+
+    // Smallest free block that fits, as long as it is not much larger
+    std::multimap<size_t, void *>::iterator it = a.free_blocks.lower_bound(size);
+    void *p = NULL;
+    if (it != a.free_blocks.end() && it->first <= 2 * size)
+    {
+        p = it->second;
+        size = it->first;
+        a.free_blocks.erase(it);
+        a.reuses++;
+    }
+    else
+    {
+        // A larger request usually replaces the largest cached block; drop
+        // it rather than keep both mapped
+        if (!a.free_blocks.empty())
+        {
+            std::multimap<size_t, void *>::iterator largest = --a.free_blocks.end();
+            if (largest->first < size)
+            {
+                munmap(largest->second, largest->first);
+                a.mapped -= (long long)largest->first;
+                a.free_blocks.erase(largest);
+            }
+        }
+        p = arena_map_block(a, size);
+        if (p == NULL)
+            throw std::bad_alloc();
+    }
+    a.live[p] = std::make_pair(size, true);
+    arena_count(a, (long long)size);
+    return p;
+}
+
+// Returns a buffer from arena_acquire to the pool
+inline void arena_release(void *p)
+{
+    if (p == NULL)
+        return;
+    BufferArena &a = buffer_arena_state();
+    std::map<void *, std::pair<size_t, bool> >::iterator it = a.live.find(p);
+    if (it == a.live.end())
+        return;
+    size_t size = it->second.first;
+    bool pooled = it->second.second;
+    a.live.erase(it);
+    a.in_use -= (long long)size;
+    if (pooled)
+        a.free_blocks.insert(std::make_pair(size, p));
+    else
+        free(p);
+}
+
+// Unmaps every free block; blocks in use are not affected
+inline void arena_trim()
+{
+    BufferArena &a = buffer_arena_state();
+    for (std::multimap<size_t, void *>::iterator it = a.free_blocks.begin(); it != a.free_blocks.end(); ++it)
+    {
+        munmap(it->second, it->first);
+        a.mapped -= (long long)it->first;
+    }
+    a.free_blocks.clear();
+}
+
+// std::vector allocator drawing from the arena
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+    ArenaAllocator() {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &) {}
+    T *allocate(size_t n) { return (T *)arena_acquire(n * sizeof(T)); }
+    void deallocate(T *p, size_t) { arena_release(p); }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return false; }
+
+template <typename T>
+using arena_vector = std::vector<T, ArenaAllocator<T> >;
+
+// Same, but resize and the sized constructor default-initialize instead of
+// value-initialize, so scratch buffers are not zero-filled first
+template <typename T>
+struct ArenaRawAllocator
+{
+    typedef T value_type;
+    ArenaRawAllocator() {}
+    template <typename U>
+    ArenaRawAllocator(const ArenaRawAllocator<U> &) {}
+    T *allocate(size_t n) { return (T *)arena_acquire(n * sizeof(T)); }
+    void deallocate(T *p, size_t) { arena_release(p); }
+    template <typename U>
+    void construct(U *p) { ::new ((void *)p) U; }
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args) { ::new ((void *)p) U(std::forward<Args>(args)...); }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaRawAllocator<T> &, const ArenaRawAllocator<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const ArenaRawAllocator<T> &, const ArenaRawAllocator<U> &) { return false; }
+
+template <typename T>
+using arena_raw_vector = std::vector<T, ArenaRawAllocator<T> >;
+
+// Collective over comm: records the high-water marks as Caliper globals
+// (call before the Caliper flush), prints a summary on rank 0 and unmaps
+// the free blocks. All ranks must have entered the same phases.
+inline void arena_finalize(MPI_Comm comm)
+{
+    BufferArena &a = buffer_arena_state();
+    arena_init();
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    long long local[4] = {a.peak_in_use, a.peak_mapped, a.maps, a.reuses}, global[4];
+    MPI_Allreduce(local, global, 4, MPI_LONG_LONG, MPI_MAX, comm);
+    long long min_peak;
+    MPI_Allreduce(&a.peak_in_use, &min_peak, 1, MPI_LONG_LONG, MPI_MIN, comm);
+
+    int local_phases = (int)a.phases.size(), nphases;
+    MPI_Allreduce(&local_phases, &nphases, 1, MPI_INT, MPI_MAX, comm);
+    cali_set_global_uint_byname("arena.peak_bytes", (unsigned long long)global[0]);
+    cali_set_global_uint_byname("arena.mapped_peak_bytes", (unsigned long long)global[1]);
+    for (int i = 0; i < nphases; i++)
+    {
+        long long peak = i < local_phases ? a.phases[i].peak : 0, max_peak;
+        MPI_Allreduce(&peak, &max_peak, 1, MPI_LONG_LONG, MPI_MAX, comm);
+        std::string name = "arena.peak_bytes.";
+        name += i < local_phases ? a.phases[i].name : "unnamed";
+        cali_set_global_uint_byname(name.c_str(), (unsigned long long)max_peak);
+    }
+
+    if (rank == 0)
+        printf("Arena: peak %lld bytes/rank (min %lld), mapped peak %lld, %lld blocks mapped, %lld reused\n",
+               global[0], min_peak, global[1], global[2], global[3]);
+    arena_trim();
+}
+
+#endif
@@ -0,0 +1,586 @@
+/******************************************************************************
+ * FILE: comm_trace.h
+ * DESCRIPTION:
+ *   Optional per-phase communication matrix tracing for the MPI sorters.
+ *   Every rank keeps a row of byte/message counters per phase (one entry per
+ *   destination rank) that the trace_* wrappers below update in place; there
+ *   is no per-call logging. At the end of the run the rows are gathered on
+ *   rank 0 and written as a p x p matrix in CSV form, together with a
+ *   critical-path summary.
+ *
+ *   Tracing is off unless SORT_COMM_TRACE is set to an output prefix, e.g.
+ *     SORT_COMM_TRACE=p512-a67108864-trandom
+ *   which produces p512-a67108864-trandom.comm.csv and
+ *   p512-a67108864-trandom.comm_summary.txt next to the .cali file.
+ *
+ *   All ranks must enter the same phases in the same order; rows are
+ *   matched by phase index and comm_trace_finalize warns if the names
+ *   differ. Only the first COMM_TRACE_MAX_PHASES phases get their own row,
+ *   later new phases are charged to the current one (with a warning).
+ *   Collectives are counted by their logical point-to-point volume
+ *   (e.g. Bcast = root sends count to every other rank, Exscan = each rank
+ *   sends count to the next). Self-copies and Allreduce payloads are not
+ *   counted, only Allreduce time is.
+ ******************************************************************************/
+
+#ifndef COMM_TRACE_H
+#define COMM_TRACE_H
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#define COMM_TRACE_MAX_PHASES 64
+
+struct CommTracePhase {
+    std::string name;
+    std::vector<long long> bytes;    // bytes sent from this rank to each rank
+    std::vector<long long> msgs;     // messages sent from this rank to each rank
+    double time;                     // seconds spent inside traced calls
+};
+
+struct CommTrace {
+    bool enabled;
+    std::string prefix;
+    MPI_Comm comm;
+    int rank;
+    int size;
+    int current;
+    std::vector<CommTracePhase> phases;
+    void (*phase_hook)(const char *);  // also told about phase switches, traced or not
+    int rank_keyval;                   // attribute caching sub-communicator rank maps
+    bool overflow_warned;              // COMM_TRACE_MAX_PHASES was hit
+};
+
+inline CommTrace &comm_trace_state()
+{
+    static CommTrace state = {false, "", MPI_COMM_NULL, 0, 1, -1, std::vector<CommTracePhase>(), NULL,
+                             MPI_KEYVAL_INVALID, false};
+    return state;
+}
+
+// Must be called after MPI_Init by every rank of comm
+inline void comm_trace_init(MPI_Comm comm)
+{
+    CommTrace &t = comm_trace_state();
+    const char *prefix = getenv("SORT_COMM_TRACE");
+    t.enabled = (prefix != NULL && prefix[0] != '\0');
+    if (!t.enabled)
+        return;
+    t.prefix = prefix;
+    t.comm = comm;
+    MPI_Comm_rank(comm, &t.rank);
+    MPI_Comm_size(comm, &t.size);
+    t.phases.clear();
+    t.current = -1;
+    t.overflow_warned = false;
+}
+
+inline bool comm_trace_enabled()
+{
+    return comm_trace_state().enabled;
+}
+
+// Switch the phase that subsequent traced calls are charged to
+inline void comm_trace_phase(const char *name)
+{
+    CommTrace &t = comm_trace_state();
+    if (t.phase_hook != NULL)
+        t.phase_hook(name);
+    if (!t.enabled)
+        return;
+    for (size_t i = 0; i < t.phases.size(); i++)
+    {
+        if (t.phases[i].name == name)
+        {
+            t.current = (int)i;
+            return;
+        }
+    }
+    if (t.phases.size() >= COMM_TRACE_MAX_PHASES)
+    {
+        if (!t.overflow_warned && t.rank == 0)
+            fprintf(stderr, "comm_trace: more than %d phases, \"%s\" and later new phases are charged to \"%s\"\n",
+                    COMM_TRACE_MAX_PHASES, name, t.current < 0 ? "none" : t.phases[t.current].name.c_str());
+        t.overflow_warned = true;
+        return;
+    }
+    CommTracePhase ph;
+    ph.name = name;
+    ph.bytes.assign(t.size, 0);
+    ph.msgs.assign(t.size, 0);
+    ph.time = 0.0;
+    t.phases.push_back(ph);
+    t.current = (int)t.phases.size() - 1;
+}
+
+inline CommTracePhase *comm_trace_current()
+{
+    CommTrace &t = comm_trace_state();
+    if (!t.enabled)
+        return NULL;
+    if (t.current < 0)
+        comm_trace_phase("default");
+    return t.current < 0 ? NULL : &t.phases[t.current];
+}
+
+inline int comm_trace_delete_rank_map(MPI_Comm, int, void *attr, void *)
+{
+    delete (std::vector<int> *)attr;
+    return MPI_SUCCESS;
+}
+
+// Traced-communicator rank of every rank of comm. Built on first use and
+// cached as an attribute of comm, so it is freed (and never reused stale)
+// when comm is freed.
+inline const std::vector<int> &comm_trace_rank_map(MPI_Comm comm)
+{
+    CommTrace &t = comm_trace_state();
+    if (t.rank_keyval == MPI_KEYVAL_INVALID)
+        MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, comm_trace_delete_rank_map, &t.rank_keyval, NULL);
+    std::vector<int> *map;
+    int found;
+    MPI_Comm_get_attr(comm, t.rank_keyval, &map, &found);
+    if (found)
+        return *map;
+
+    int size;
+    MPI_Comm_size(comm, &size);
+    std::vector<int> ranks(size);
+    map = new std::vector<int>(size);
+    for (int i = 0; i < size; i++)
+        ranks[i] = i;
+    MPI_Group group, traced_group;
+    MPI_Comm_group(comm, &group);
+    MPI_Comm_group(t.comm, &traced_group);
+    MPI_Group_translate_ranks(group, size, ranks.data(), traced_group, map->data());
+    MPI_Group_free(&group);
+    MPI_Group_free(&traced_group);
+    MPI_Comm_set_attr(comm, t.rank_keyval, map);
+    return *map;
+}
+
+// Charge bytes sent to rank dest of comm; ranks of sub-communicators are
+// translated to the traced communicator
+inline void comm_trace_send(CommTracePhase *ph, MPI_Comm comm, int dest, long long bytes)
+{
+    CommTrace &t = comm_trace_state();
+    if (ph == NULL || dest < 0)
+        return;
+    if (comm != t.comm)
+    {
+        dest = comm_trace_rank_map(comm)[dest];
+        if (dest == MPI_UNDEFINED)
+            return;
+    }
+    if (dest == t.rank)
+        return;
+    ph->bytes[dest] += bytes;
+    ph->msgs[dest]++;
+}
+
+inline int comm_trace_rank(MPI_Comm comm)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    return rank;
+}
+
+inline int comm_trace_size(MPI_Comm comm)
+{
+    int size;
+    MPI_Comm_size(comm, &size);
+    return size;
+}
+
+// MPI_Type_size_x, since the block types of large_count.h exceed 2 GB
+inline long long comm_trace_type_size(MPI_Datatype type)
+{
+    MPI_Count sz;
+    MPI_Type_size_x(type, &sz);
+    return (long long)sz;
+}
+
+// Traced wrappers for the MPI calls used by the sorters
+
+inline int trace_Send(const void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Send(buf, count, type, dest, tag, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Send(buf, count, type, dest, tag, comm);
+    ph->time += MPI_Wtime() - t0;
+    comm_trace_send(ph, comm, dest, (long long)count * comm_trace_type_size(type));
+    return rc;
+}
+
+// One-sided put; comm is the communicator the window was created on. Only
+// the time to issue the put is counted, completion is in the fence.
+inline int trace_Put(const void *buf, int count, MPI_Datatype type, int target, MPI_Aint target_disp,
+                     MPI_Win win, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Put(buf, count, type, target, target_disp, count, type, win);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Put(buf, count, type, target, target_disp, count, type, win);
+    ph->time += MPI_Wtime() - t0;
+    comm_trace_send(ph, comm, target, (long long)count * comm_trace_type_size(type));
+    return rc;
+}
+
+inline int trace_Recv(void *buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Recv(buf, count, type, source, tag, comm, status);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Recv(buf, count, type, source, tag, comm, status);
+    ph->time += MPI_Wtime() - t0;
+    return rc;
+}
+
+inline int trace_Sendrecv(const void *sbuf, int scount, MPI_Datatype stype, int dest, int stag,
+                          void *rbuf, int rcount, MPI_Datatype rtype, int source, int rtag,
+                          MPI_Comm comm, MPI_Status *status)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Sendrecv(sbuf, scount, stype, dest, stag, rbuf, rcount, rtype, source, rtag, comm, status);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Sendrecv(sbuf, scount, stype, dest, stag, rbuf, rcount, rtype, source, rtag, comm, status);
+    ph->time += MPI_Wtime() - t0;
+    if (dest != MPI_PROC_NULL && scount > 0)
+        comm_trace_send(ph, comm, dest, (long long)scount * comm_trace_type_size(stype));
+    return rc;
+}
+
+inline int trace_Bcast(void *buf, int count, MPI_Datatype type, int root, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Bcast(buf, count, type, root, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Bcast(buf, count, type, root, comm);
+    ph->time += MPI_Wtime() - t0;
+    if (comm_trace_rank(comm) == root)
+    {
+        long long bytes = (long long)count * comm_trace_type_size(type);
+        for (int i = 0; i < comm_trace_size(comm); i++)
+            comm_trace_send(ph, comm, i, bytes);
+    }
+    return rc;
+}
+
+inline int trace_Gather(const void *sbuf, int scount, MPI_Datatype stype,
+                        void *rbuf, int rcount, MPI_Datatype rtype, int root, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Gather(sbuf, scount, stype, rbuf, rcount, rtype, root, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Gather(sbuf, scount, stype, rbuf, rcount, rtype, root, comm);
+    ph->time += MPI_Wtime() - t0;
+    if (sbuf != MPI_IN_PLACE)
+        comm_trace_send(ph, comm, root, (long long)scount * comm_trace_type_size(stype));
+    return rc;
+}
+
+inline int trace_Gatherv(const void *sbuf, int scount, MPI_Datatype stype,
+                         void *rbuf, const int *rcounts, const int *displs, MPI_Datatype rtype, int root,
+                         MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Gatherv(sbuf, scount, stype, rbuf, rcounts, displs, rtype, root, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Gatherv(sbuf, scount, stype, rbuf, rcounts, displs, rtype, root, comm);
+    ph->time += MPI_Wtime() - t0;
+    if (sbuf != MPI_IN_PLACE && scount > 0)
+        comm_trace_send(ph, comm, root, (long long)scount * comm_trace_type_size(stype));
+    return rc;
+}
+
+inline int trace_Scatter(const void *sbuf, int scount, MPI_Datatype stype,
+                         void *rbuf, int rcount, MPI_Datatype rtype, int root, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Scatter(sbuf, scount, stype, rbuf, rcount, rtype, root, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Scatter(sbuf, scount, stype, rbuf, rcount, rtype, root, comm);
+    ph->time += MPI_Wtime() - t0;
+    if (comm_trace_rank(comm) == root)
+    {
+        long long bytes = (long long)scount * comm_trace_type_size(stype);
+        for (int i = 0; i < comm_trace_size(comm); i++)
+            comm_trace_send(ph, comm, i, bytes);
+    }
+    return rc;
+}
+
+inline int trace_Scatterv(const void *sbuf, const int *scounts, const int *displs, MPI_Datatype stype,
+                          void *rbuf, int rcount, MPI_Datatype rtype, int root, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Scatterv(sbuf, scounts, displs, stype, rbuf, rcount, rtype, root, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Scatterv(sbuf, scounts, displs, stype, rbuf, rcount, rtype, root, comm);
+    ph->time += MPI_Wtime() - t0;
+    if (comm_trace_rank(comm) == root)
+    {
+        long long tsize = comm_trace_type_size(stype);
+        for (int i = 0; i < comm_trace_size(comm); i++)
+            comm_trace_send(ph, comm, i, (long long)scounts[i] * tsize);
+    }
+    return rc;
+}
+
+inline int trace_Allgather(const void *sbuf, int scount, MPI_Datatype stype,
+                           void *rbuf, int rcount, MPI_Datatype rtype, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Allgather(sbuf, scount, stype, rbuf, rcount, rtype, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Allgather(sbuf, scount, stype, rbuf, rcount, rtype, comm);
+    ph->time += MPI_Wtime() - t0;
+    long long bytes = (long long)scount * comm_trace_type_size(stype);
+    for (int i = 0; i < comm_trace_size(comm); i++)
+        comm_trace_send(ph, comm, i, bytes);
+    return rc;
+}
+
+inline int trace_Allgatherv(const void *sbuf, int scount, MPI_Datatype stype,
+                            void *rbuf, const int *rcounts, const int *displs, MPI_Datatype rtype, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Allgatherv(sbuf, scount, stype, rbuf, rcounts, displs, rtype, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Allgatherv(sbuf, scount, stype, rbuf, rcounts, displs, rtype, comm);
+    ph->time += MPI_Wtime() - t0;
+    if (scount > 0)
+    {
+        long long bytes = (long long)scount * comm_trace_type_size(stype);
+        for (int i = 0; i < comm_trace_size(comm); i++)
+            comm_trace_send(ph, comm, i, bytes);
+    }
+    return rc;
+}
+
+inline int trace_Alltoall(const void *sbuf, int scount, MPI_Datatype stype,
+                          void *rbuf, int rcount, MPI_Datatype rtype, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Alltoall(sbuf, scount, stype, rbuf, rcount, rtype, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Alltoall(sbuf, scount, stype, rbuf, rcount, rtype, comm);
+    ph->time += MPI_Wtime() - t0;
+    long long bytes = (long long)scount * comm_trace_type_size(stype);
+    for (int i = 0; i < comm_trace_size(comm); i++)
+        comm_trace_send(ph, comm, i, bytes);
+    return rc;
+}
+
+inline int trace_Alltoallv(const void *sbuf, const int *scounts, const int *sdispls, MPI_Datatype stype,
+                           void *rbuf, const int *rcounts, const int *rdispls, MPI_Datatype rtype,
+                           MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Alltoallv(sbuf, scounts, sdispls, stype, rbuf, rcounts, rdispls, rtype, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Alltoallv(sbuf, scounts, sdispls, stype, rbuf, rcounts, rdispls, rtype, comm);
+    ph->time += MPI_Wtime() - t0;
+    long long tsize = comm_trace_type_size(stype);
+    for (int i = 0; i < comm_trace_size(comm); i++)
+    {
+        if (scounts[i] > 0)
+            comm_trace_send(ph, comm, i, (long long)scounts[i] * tsize);
+    }
+    return rc;
+}
+
+inline int trace_Allreduce(const void *sbuf, void *rbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Allreduce(sbuf, rbuf, count, type, op, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Allreduce(sbuf, rbuf, count, type, op, comm);
+    ph->time += MPI_Wtime() - t0;
+    return rc;
+}
+
+inline int trace_Exscan(const void *sbuf, void *rbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+    CommTracePhase *ph = comm_trace_current();
+    if (ph == NULL)
+        return MPI_Exscan(sbuf, rbuf, count, type, op, comm);
+    double t0 = MPI_Wtime();
+    int rc = MPI_Exscan(sbuf, rbuf, count, type, op, comm);
+    ph->time += MPI_Wtime() - t0;
+    int rank = comm_trace_rank(comm);
+    if (rank + 1 < comm_trace_size(comm))
+        comm_trace_send(ph, comm, rank + 1, (long long)count * comm_trace_type_size(type));
+    return rc;
+}
+
+// FNV-1a hash of a phase name, so finalize can compare names across ranks
+// without gathering the strings. 0 is reserved for "no such phase".
+inline unsigned long long comm_trace_name_hash(const std::string &name)
+{
+    unsigned long long h = 1469598103934665603ULL;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h == 0 ? 1 : h;
+}
+
+// Gather all phase rows on rank 0 and write the matrix and the summary.
+// Collective over the communicator passed to comm_trace_init.
+inline void comm_trace_finalize()
+{
+    CommTrace &t = comm_trace_state();
+    if (!t.enabled)
+        return;
+
+    int p = t.size;
+    int local_phases = (int)t.phases.size();
+    int nphases;
+    MPI_Allreduce(&local_phases, &nphases, 1, MPI_INT, MPI_MAX, t.comm);
+
+    FILE *csv = NULL;
+    FILE *summary = NULL;
+    if (t.rank == 0)
+    {
+        csv = fopen((t.prefix + ".comm.csv").c_str(), "w");
+        summary = fopen((t.prefix + ".comm_summary.txt").c_str(), "w");
+        if (csv == NULL || summary == NULL)
+        {
+            fprintf(stderr, "comm_trace: cannot open output files for prefix %s\n", t.prefix.c_str());
+        }
+        if (csv != NULL)
+            fprintf(csv, "phase,src,dst,bytes,messages\n");
+        if (summary != NULL)
+            fprintf(summary, "# Communication summary, %d ranks\n", p);
+    }
+
+    std::vector<long long> all_bytes, all_msgs;
+    std::vector<double> all_times;
+    std::vector<unsigned long long> all_names;
+    if (t.rank == 0)
+    {
+        all_bytes.resize((size_t)p * p);
+        all_msgs.resize((size_t)p * p);
+        all_times.resize(p);
+        all_names.resize(p);
+    }
+    std::vector<long long> zeros(p, 0);
+
+    double critical_path = 0.0;
+    for (int k = 0; k < nphases; k++)
+    {
+        // Ranks that never entered phase k contribute zeros
+        const long long *row_bytes = k < (int)t.phases.size() ? t.phases[k].bytes.data() : zeros.data();
+        const long long *row_msgs = k < (int)t.phases.size() ? t.phases[k].msgs.data() : zeros.data();
+        double time = k < (int)t.phases.size() ? t.phases[k].time : 0.0;
+        unsigned long long name_hash = k < (int)t.phases.size() ? comm_trace_name_hash(t.phases[k].name) : 0;
+
+        MPI_Gather(row_bytes, p, MPI_LONG_LONG, all_bytes.data(), p, MPI_LONG_LONG, 0, t.comm);
+        MPI_Gather(row_msgs, p, MPI_LONG_LONG, all_msgs.data(), p, MPI_LONG_LONG, 0, t.comm);
+        MPI_Gather(&time, 1, MPI_DOUBLE, all_times.data(), 1, MPI_DOUBLE, 0, t.comm);
+        MPI_Gather(&name_hash, 1, MPI_UNSIGNED_LONG_LONG, all_names.data(), 1, MPI_UNSIGNED_LONG_LONG, 0, t.comm);
+
+        if (t.rank != 0)
+            continue;
+
+        const char *name = k < (int)t.phases.size() ? t.phases[k].name.c_str() : "unnamed";
+        int mismatch = -1;
+        for (int r = 0; r < p && mismatch < 0; r++)
+        {
+            if (all_names[r] != 0 && name_hash != 0 && all_names[r] != name_hash)
+                mismatch = r;
+        }
+        if (mismatch >= 0)
+            fprintf(stderr, "comm_trace: phase %d is \"%s\" on rank 0 but named differently on rank %d\n",
+                    k, name, mismatch);
+        long long total_bytes = 0, total_msgs = 0;
+        long long pair_bytes = 0;
+        int pair_src = 0, pair_dst = 0;
+        std::vector<long long> sent(p, 0), received(p, 0);
+        for (int s = 0; s < p; s++)
+        {
+            for (int d = 0; d < p; d++)
+            {
+                long long b = all_bytes[(size_t)s * p + d];
+                long long m = all_msgs[(size_t)s * p + d];
+                if (b == 0 && m == 0)
+                    continue;
+                if (csv != NULL)
+                    fprintf(csv, "%s,%d,%d,%lld,%lld\n", name, s, d, b, m);
+                total_bytes += b;
+                total_msgs += m;
+                sent[s] += b;
+                received[d] += b;
+                if (b > pair_bytes)
+                {
+                    pair_bytes = b;
+                    pair_src = s;
+                    pair_dst = d;
+                }
+            }
+        }
+
+        int slowest = 0, hot_sender = 0, hot_receiver = 0;
+        double mean_time = 0.0;
+        for (int r = 0; r < p; r++)
+        {
+            mean_time += all_times[r];
+            if (all_times[r] > all_times[slowest])
+                slowest = r;
+            if (sent[r] > sent[hot_sender])
+                hot_sender = r;
+            if (received[r] > received[hot_receiver])
+                hot_receiver = r;
+        }
+        mean_time /= p;
+        critical_path += all_times[slowest];
+
+        if (summary != NULL)
+        {
+            fprintf(summary, "\n[%s]\n", name);
+            if (mismatch >= 0)
+                fprintf(summary, "  WARNING            : phase name differs on rank %d, rows may be mixed\n", mismatch);
+            fprintf(summary, "  total bytes        : %lld\n", total_bytes);
+            fprintf(summary, "  total messages     : %lld\n", total_msgs);
+            fprintf(summary, "  max rank time      : %.6f s (rank %d)\n", all_times[slowest], slowest);
+            fprintf(summary, "  mean rank time     : %.6f s\n", mean_time);
+            fprintf(summary, "  time imbalance     : %.2f (max/mean)\n", mean_time > 0.0 ? all_times[slowest] / mean_time : 0.0);
+            fprintf(summary, "  hottest sender     : rank %d, %lld bytes\n", hot_sender, sent[hot_sender]);
+            fprintf(summary, "  hottest receiver   : rank %d, %lld bytes\n", hot_receiver, received[hot_receiver]);
+            fprintf(summary, "  heaviest pair      : %d -> %d, %lld bytes\n", pair_src, pair_dst, pair_bytes);
+        }
+    }
+
+    if (t.rank == 0)
+    {
+        if (summary != NULL)
+        {
+            fprintf(summary, "\ncritical path (sum of per-phase max rank time): %.6f s\n", critical_path);
+            fclose(summary);
+        }
+        if (csv != NULL)
+            fclose(csv);
+    }
+}
+
+#endif
@@ -0,0 +1,491 @@
+/******************************************************************************
+ * FILE: large_count.h
+ * DESCRIPTION:
+ *   Helpers for moving more than 2^31 - 1 elements in one MPI call.
+ *   Counts and displacements are long long everywhere in the sorters; these
+ *   wrappers pass them straight through when they fit in an int, use the
+ *   MPI-4 large-count (_c) calls when the library has them (MPI_VERSION >= 4),
+ *   and otherwise describe a large block as a single derived datatype (chunks
+ *   of LARGE_COUNT_CHUNK elements plus a remainder) so a count of 1 can be
+ *   sent. Without _c calls the vector collectives fall back to point-to-point
+ *   blocks (large_pairwise_exchange).
+ *
+ *   large_Alltoallv needs every rank on the same path. By default it finds
+ *   out with an Allreduce; callers that swap their counts with
+ *   large_count_exchange get the path from that Alltoall instead and pass it
+ *   in, so the exchange costs no extra collective.
+ *
+ *   All wrappers go through the comm_trace.h counters.
+ ******************************************************************************/
+
+#ifndef LARGE_COUNT_H
+#define LARGE_COUNT_H
+
+#include <mpi.h>
+#include <algorithm>
+#include <climits>
+#include <vector>
+#include "comm_trace.h"
+
+// Elements per chunk when a block is described as a derived datatype
+#define LARGE_COUNT_CHUNK (1LL << 30)
+
+// Path of large_Alltoallv: every count and displacement fits in an int,
+// some do not, or not known yet (large_Alltoallv reduces to find out)
+#define LARGE_COUNT_FITS 1
+#define LARGE_COUNT_EXCEEDS 0
+#define LARGE_COUNT_CHECK -1
+
+inline bool fits_int(long long v)
+{
+    return v >= 0 && v <= INT_MAX;
+}
+
+// Committed datatype describing count contiguous elements of base. Free with
+// MPI_Type_free. Its extent is count * extent(base), so consecutive blocks in
+// Gather/Scatter land at the right offsets.
+inline void large_count_type(long long count, MPI_Datatype base, MPI_Datatype *out)
+{
+    if (fits_int(count))
+    {
+        MPI_Type_contiguous((int)count, base, out);
+        MPI_Type_commit(out);
+        return;
+    }
+
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(base, &lb, &extent);
+
+    long long nchunks = count / LARGE_COUNT_CHUNK;
+    long long rem = count % LARGE_COUNT_CHUNK;
+
+    MPI_Datatype chunk, chunks;
+    MPI_Type_contiguous((int)LARGE_COUNT_CHUNK, base, &chunk);
+    MPI_Type_contiguous((int)nchunks, chunk, &chunks);
+
+    int blocklens[2] = {1, (int)rem};
+    MPI_Aint displs[2] = {0, (MPI_Aint)(nchunks * LARGE_COUNT_CHUNK) * extent};
+    MPI_Datatype types[2] = {chunks, base};
+    MPI_Type_create_struct(rem > 0 ? 2 : 1, blocklens, displs, types, out);
+    MPI_Type_commit(out);
+
+    MPI_Type_free(&chunk);
+    MPI_Type_free(&chunks);
+}
+
+#if MPI_VERSION >= 4
+// Charges a large-count (_c) call started at t0; dest < 0 charges time only
+inline void large_count_charge(CommTracePhase *ph, double t0, MPI_Comm comm, int dest, long long count,
+                               MPI_Datatype type)
+{
+    if (ph == NULL)
+        return;
+    ph->time += MPI_Wtime() - t0;
+    if (dest >= 0 && count > 0)
+        comm_trace_send(ph, comm, dest, count * comm_trace_type_size(type));
+}
+#endif
+
+inline int large_Send(const void *buf, long long count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
+{
+    if (fits_int(count))
+        return trace_Send(buf, (int)count, type, dest, tag, comm);
+#if MPI_VERSION >= 4
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int rc = MPI_Send_c(buf, (MPI_Count)count, type, dest, tag, comm);
+    large_count_charge(ph, t0, comm, dest, count, type);
+    return rc;
+#else
+    MPI_Datatype block;
+    large_count_type(count, type, &block);
+    int rc = trace_Send(buf, 1, block, dest, tag, comm);
+    MPI_Type_free(&block);
+    return rc;
+#endif
+}
+
+inline int large_Recv(void *buf, long long count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    if (fits_int(count))
+        return trace_Recv(buf, (int)count, type, source, tag, comm, status);
+#if MPI_VERSION >= 4
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int rc = MPI_Recv_c(buf, (MPI_Count)count, type, source, tag, comm, status);
+    large_count_charge(ph, t0, comm, -1, 0, type);
+    return rc;
+#else
+    MPI_Datatype block;
+    large_count_type(count, type, &block);
+    int rc = trace_Recv(buf, 1, block, source, tag, comm, status);
+    MPI_Type_free(&block);
+    return rc;
+#endif
+}
+
+inline int large_Put(const void *buf, long long count, MPI_Datatype type, int target, MPI_Aint target_disp,
+                     MPI_Win win, MPI_Comm comm)
+{
+    if (fits_int(count))
+        return trace_Put(buf, (int)count, type, target, target_disp, win, comm);
+#if MPI_VERSION >= 4
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int rc = MPI_Put_c(buf, (MPI_Count)count, type, target, target_disp, (MPI_Count)count, type, win);
+    large_count_charge(ph, t0, comm, target, count, type);
+    return rc;
+#else
+    MPI_Datatype block;
+    large_count_type(count, type, &block);
+    int rc = trace_Put(buf, 1, block, target, target_disp, win, comm);
+    MPI_Type_free(&block);
+    return rc;
+#endif
+}
+
+// Same count in both directions, as in the bitonic exchange
+inline int large_Sendrecv(const void *sbuf, long long count, MPI_Datatype type, int dest, int stag,
+                          void *rbuf, int source, int rtag, MPI_Comm comm, MPI_Status *status)
+{
+    if (fits_int(count))
+        return trace_Sendrecv(sbuf, (int)count, type, dest, stag, rbuf, (int)count, type, source, rtag, comm, status);
+#if MPI_VERSION >= 4
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int rc = MPI_Sendrecv_c(sbuf, (MPI_Count)count, type, dest, stag, rbuf, (MPI_Count)count, type, source, rtag,
+                            comm, status);
+    large_count_charge(ph, t0, comm, dest == MPI_PROC_NULL ? -1 : dest, count, type);
+    return rc;
+#else
+    MPI_Datatype block;
+    large_count_type(count, type, &block);
+    int rc = trace_Sendrecv(sbuf, 1, block, dest, stag, rbuf, 1, block, source, rtag, comm, status);
+    MPI_Type_free(&block);
+    return rc;
+#endif
+}
+
+// Equal-sized blocks of count elements per rank
+inline int large_Scatter(const void *sbuf, long long count, MPI_Datatype type,
+                         void *rbuf, int root, MPI_Comm comm)
+{
+    if (fits_int(count))
+        return trace_Scatter(sbuf, (int)count, type, rbuf, (int)count, type, root, comm);
+#if MPI_VERSION >= 4
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int rc = MPI_Scatter_c(sbuf, (MPI_Count)count, type, rbuf, (MPI_Count)count, type, root, comm);
+    large_count_charge(ph, t0, comm, -1, 0, type);
+    if (ph != NULL && comm_trace_rank(comm) == root)
+    {
+        for (int i = 0; i < comm_trace_size(comm); i++)
+            comm_trace_send(ph, comm, i, count * comm_trace_type_size(type));
+    }
+    return rc;
+#else
+    MPI_Datatype block;
+    large_count_type(count, type, &block);
+    int rc = trace_Scatter(sbuf, 1, block, rbuf, 1, block, root, comm);
+    MPI_Type_free(&block);
+    return rc;
+#endif
+}
+
+inline int large_Gather(const void *sbuf, long long count, MPI_Datatype type,
+                        void *rbuf, int root, MPI_Comm comm)
+{
+    if (fits_int(count))
+        return trace_Gather(sbuf, (int)count, type, rbuf, (int)count, type, root, comm);
+#if MPI_VERSION >= 4
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int rc = MPI_Gather_c(sbuf, (MPI_Count)count, type, rbuf, (MPI_Count)count, type, root, comm);
+    large_count_charge(ph, t0, comm, sbuf == MPI_IN_PLACE ? -1 : root, count, type);
+    return rc;
+#else
+    MPI_Datatype block;
+    large_count_type(count, type, &block);
+    int rc = trace_Gather(sbuf, 1, block, rbuf, 1, block, root, comm);
+    MPI_Type_free(&block);
+    return rc;
+#endif
+}
+
+// Pairwise fallback for vector collectives whose counts or displacements
+// overflow int. Charges the traced phase with the logical volume.
+inline int large_pairwise_exchange(const char *sbuf, const long long *scounts, const long long *sdispls,
+                                   char *rbuf, const long long *rcounts, const long long *rdispls,
+                                   MPI_Datatype type, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(type, &lb, &extent);
+
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+
+    std::vector<MPI_Request> reqs;
+    std::vector<MPI_Datatype> blocks;
+    reqs.reserve(2 * size);
+    blocks.reserve(2 * size);
+    for (int i = 0; i < size; i++)
+    {
+        if (rcounts == NULL || rcounts[i] == 0)
+            continue;
+        MPI_Datatype block;
+        large_count_type(rcounts[i], type, &block);
+        blocks.push_back(block);
+        reqs.push_back(MPI_REQUEST_NULL);
+        MPI_Irecv(rbuf + (MPI_Aint)rdispls[i] * extent, 1, block, i, 0, comm, &reqs.back());
+    }
+    for (int i = 0; i < size; i++)
+    {
+        if (scounts == NULL || scounts[i] == 0)
+            continue;
+        MPI_Datatype block;
+        large_count_type(scounts[i], type, &block);
+        blocks.push_back(block);
+        reqs.push_back(MPI_REQUEST_NULL);
+        MPI_Isend(sbuf + (MPI_Aint)sdispls[i] * extent, 1, block, i, 0, comm, &reqs.back());
+        comm_trace_send(ph, comm, i, scounts[i] * (long long)extent);
+    }
+    int rc = MPI_Waitall((int)reqs.size(), reqs.data(), MPI_STATUSES_IGNORE);
+    for (size_t i = 0; i < blocks.size(); i++)
+        MPI_Type_free(&blocks[i]);
+
+    if (ph != NULL)
+        ph->time += MPI_Wtime() - t0;
+    return rc;
+}
+
+// Alltoall of the per-destination counts of a following large_Alltoallv.
+// Each count travels with the sender's send extent (largest sdispls[i] +
+// scounts[i]), so every rank learns all of them and returns the same path:
+// LARGE_COUNT_FITS if their sum fits in an int (no rank can send or receive
+// more), LARGE_COUNT_EXCEEDS if one of them does not, and LARGE_COUNT_CHECK
+// otherwise, since then only the receive sides can tell.
+inline int large_count_exchange(const long long *scounts, const long long *sdispls, long long *rcounts,
+                                MPI_Comm comm)
+{
+    int size;
+    MPI_Comm_size(comm, &size);
+    long long extent = 0;
+    for (int i = 0; i < size; i++)
+        extent = std::max(extent, sdispls[i] + scounts[i]);
+
+    std::vector<long long> spairs(2 * size), rpairs(2 * size);
+    for (int i = 0; i < size; i++)
+    {
+        spairs[2 * i] = scounts[i];
+        spairs[2 * i + 1] = extent;
+    }
+    trace_Alltoall(spairs.data(), 2, MPI_LONG_LONG, rpairs.data(), 2, MPI_LONG_LONG, comm);
+
+    long long total = 0;
+    bool exceeds = false;
+    for (int i = 0; i < size; i++)
+    {
+        rcounts[i] = rpairs[2 * i];
+        total += rpairs[2 * i + 1];
+        exceeds = exceeds || !fits_int(rpairs[2 * i + 1]);
+    }
+    if (exceeds)
+        return LARGE_COUNT_EXCEEDS;
+    return fits_int(total) ? LARGE_COUNT_FITS : LARGE_COUNT_CHECK;
+}
+
+// path is the result of large_count_exchange, or LARGE_COUNT_CHECK to have
+// the ranks agree on it here with an Allreduce
+inline int large_Alltoallv(const void *sbuf, const long long *scounts, const long long *sdispls,
+                           void *rbuf, const long long *rcounts, const long long *rdispls,
+                           MPI_Datatype type, MPI_Comm comm, int path = LARGE_COUNT_CHECK)
+{
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    // Every rank has to take the same path
+    int small = path;
+    if (path == LARGE_COUNT_CHECK)
+    {
+        int local_small = 1;
+        for (int i = 0; i < size && local_small; i++)
+        {
+            local_small = fits_int(sdispls[i] + scounts[i]) && fits_int(rdispls[i] + rcounts[i]);
+        }
+        MPI_Allreduce(&local_small, &small, 1, MPI_INT, MPI_MIN, comm);
+    }
+
+    if (small)
+    {
+        std::vector<int> sc(size), sd(size), rc(size), rd(size);
+        for (int i = 0; i < size; i++)
+        {
+            sc[i] = (int)scounts[i];
+            sd[i] = (int)sdispls[i];
+            rc[i] = (int)rcounts[i];
+            rd[i] = (int)rdispls[i];
+        }
+        return trace_Alltoallv(sbuf, sc.data(), sd.data(), type, rbuf, rc.data(), rd.data(), type, comm);
+    }
+
+#if MPI_VERSION >= 4
+    std::vector<MPI_Count> sc(size), rc(size);
+    std::vector<MPI_Aint> sd(size), rd(size);
+    for (int i = 0; i < size; i++)
+    {
+        sc[i] = scounts[i];
+        sd[i] = sdispls[i];
+        rc[i] = rcounts[i];
+        rd[i] = rdispls[i];
+    }
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int ret = MPI_Alltoallv_c(sbuf, sc.data(), sd.data(), type, rbuf, rc.data(), rd.data(), type, comm);
+    if (ph != NULL)
+    {
+        ph->time += MPI_Wtime() - t0;
+        long long tsize = comm_trace_type_size(type);
+        for (int i = 0; i < size; i++)
+        {
+            if (scounts[i] > 0)
+                comm_trace_send(ph, comm, i, scounts[i] * tsize);
+        }
+    }
+    return ret;
+#else
+    return large_pairwise_exchange((const char *)sbuf, scounts, sdispls, (char *)rbuf, rcounts, rdispls, type, comm);
+#endif
+}
+
+// Root sends scounts[i] elements starting at displs[i] to rank i
+inline int large_Scatterv(const void *sbuf, const long long *scounts, const long long *displs,
+                          void *rbuf, long long rcount, MPI_Datatype type, int root, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // Every rank needs to agree on the path, so decide from the local count
+    // and the largest count/displacement seen by the root
+    long long root_max = 0;
+    if (rank == root)
+    {
+        for (int i = 0; i < size; i++)
+            root_max = std::max(root_max, displs[i] + scounts[i]);
+    }
+    long long local_max = std::max(root_max, rcount), global_max;
+    MPI_Allreduce(&local_max, &global_max, 1, MPI_LONG_LONG, MPI_MAX, comm);
+
+    if (fits_int(global_max))
+    {
+        std::vector<int> sc, sd;
+        if (rank == root)
+        {
+            sc.resize(size);
+            sd.resize(size);
+            for (int i = 0; i < size; i++)
+            {
+                sc[i] = (int)scounts[i];
+                sd[i] = (int)displs[i];
+            }
+        }
+        return trace_Scatterv(sbuf, sc.data(), sd.data(), type, rbuf, (int)rcount, type, root, comm);
+    }
+
+#if MPI_VERSION >= 4
+    std::vector<MPI_Count> sc(size, 0);
+    std::vector<MPI_Aint> sd(size, 0);
+    if (rank == root)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            sc[i] = scounts[i];
+            sd[i] = displs[i];
+        }
+    }
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int ret = MPI_Scatterv_c(sbuf, sc.data(), sd.data(), type, rbuf, (MPI_Count)rcount, type, root, comm);
+    large_count_charge(ph, t0, comm, -1, 0, type);
+    for (int i = 0; i < size && ph != NULL && rank == root; i++)
+        comm_trace_send(ph, comm, i, scounts[i] * comm_trace_type_size(type));
+    return ret;
+#else
+    std::vector<long long> zeros(size, 0), rcounts(size, 0), rdispls(size, 0);
+    rcounts[root] = rcount;
+    return large_pairwise_exchange((const char *)sbuf, rank == root ? scounts : zeros.data(),
+                                   rank == root ? displs : zeros.data(), (char *)rbuf,
+                                   rcounts.data(), rdispls.data(), type, comm);
+#endif
+}
+
+// Rank i sends scount elements to the root, which stores them at rdispls[i]
+inline int large_Gatherv(const void *sbuf, long long scount, void *rbuf, const long long *rcounts,
+                         const long long *rdispls, MPI_Datatype type, int root, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    long long root_max = 0;
+    if (rank == root)
+    {
+        for (int i = 0; i < size; i++)
+            root_max = std::max(root_max, rdispls[i] + rcounts[i]);
+    }
+    long long local_max = std::max(root_max, scount), global_max;
+    MPI_Allreduce(&local_max, &global_max, 1, MPI_LONG_LONG, MPI_MAX, comm);
+
+    if (fits_int(global_max))
+    {
+        std::vector<int> rc, rd;
+        if (rank == root)
+        {
+            rc.resize(size);
+            rd.resize(size);
+            for (int i = 0; i < size; i++)
+            {
+                rc[i] = (int)rcounts[i];
+                rd[i] = (int)rdispls[i];
+            }
+        }
+        CommTracePhase *ph = comm_trace_current();
+        double t0 = MPI_Wtime();
+        int ret = MPI_Gatherv(sbuf, (int)scount, type, rbuf, rc.data(), rd.data(), type, root, comm);
+        if (ph != NULL)
+        {
+            ph->time += MPI_Wtime() - t0;
+            comm_trace_send(ph, comm, root, scount * comm_trace_type_size(type));
+        }
+        return ret;
+    }
+
+#if MPI_VERSION >= 4
+    std::vector<MPI_Count> rc(size, 0);
+    std::vector<MPI_Aint> rd(size, 0);
+    if (rank == root)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            rc[i] = rcounts[i];
+            rd[i] = rdispls[i];
+        }
+    }
+    CommTracePhase *ph = comm_trace_current();
+    double t0 = MPI_Wtime();
+    int ret = MPI_Gatherv_c(sbuf, (MPI_Count)scount, type, rbuf, rc.data(), rd.data(), type, root, comm);
+    large_count_charge(ph, t0, comm, root, scount, type);
+    return ret;
+#else
+    std::vector<long long> zeros(size, 0), scounts(size, 0), sdispls(size, 0);
+    scounts[root] = scount;
+    return large_pairwise_exchange((const char *)sbuf, scounts.data(), sdispls.data(), (char *)rbuf,
+                                   rank == root ? rcounts : zeros.data(),
+                                   rank == root ? rdispls : zeros.data(), type, comm);
+#endif
+}
+
+#endif
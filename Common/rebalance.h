@@ -0,0 +1,136 @@
+/******************************************************************************
+ * FILE: rebalance.h
+ * DESCRIPTION:
+ *   Redistributes a globally sorted array (rank order is key order, any
+ *   number of elements per rank) into exact blocks: rank r ends up with
+ *   global elements [r*B, (r+1)*B), B = ceil(n/p), so the last ranks may be
+ *   short when p does not divide n.
+ *
+ *   Every rank learns all block sizes from one Allgather, intersects its
+ *   current global range with the target blocks and sends only the slices
+ *   that belong elsewhere, point to point. Elements already in place stay
+ *   put, so after a sample or histogram sort (buckets close to n/p) only a
+ *   few boundary slices move between neighbouring ranks. After merge sort
+ *   (everything on rank 0) it amounts to a scatter.
+ *
+ *   The element count that changed rank is recorded as the Caliper global
+ *   rebalance.moved_elements, and the most peers any rank talked to as
+ *   rebalance.max_peers.
+ ******************************************************************************/
+
+#ifndef REBALANCE_H
+#define REBALANCE_H
+
+#include <mpi.h>
+#include <caliper/cali.h>
+#include <algorithm>
+#include <vector>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "buffer_arena.h"
+
+struct RebalanceStats
+{
+    long long n;          // elements on all ranks
+    long long block;      // target elements per rank
+    long long moved;      // elements that changed rank, summed over ranks
+    int max_peers;        // most ranks any one rank sent to or received from
+};
+
+// Collective. out receives this rank's block (out must not alias data).
+// type is the MPI datatype of T.
+template <typename T>
+void rebalance_blocks(const T *data, long long nlocal, arena_vector<T> &out, MPI_Datatype type, MPI_Comm comm,
+                      RebalanceStats *stats = NULL)
+{
+    int npes, rank;
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &rank);
+
+    // Global start of every rank's current elements
+    std::vector<long long> counts(npes), starts(npes + 1, 0);
+    comm_trace_phase("rebalance_offsets");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Allgather(&nlocal, 1, MPI_LONG_LONG, counts.data(), 1, MPI_LONG_LONG, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    for (int r = 0; r < npes; r++)
+        starts[r + 1] = starts[r] + counts[r];
+    long long n = starts[npes];
+    long long block = (n + npes - 1) / npes;
+    long long my_start = starts[rank], my_end = starts[rank] + nlocal;
+    long long target_start = std::min((long long)rank * block, n);
+    long long target_end = std::min(target_start + block, n);
+
+    // Slices of my range that belong to other blocks, and slices of my block
+    // held by other ranks; both are contiguous runs of ranks
+    std::vector<long long> scounts(npes, 0), sdispls(npes, 0), rcounts(npes, 0), rdispls(npes, 0);
+    long long sent = 0;
+    int peers = 0;
+    if (nlocal > 0 && block > 0)
+    {
+        for (long long d = my_start / block; d <= (my_end - 1) / block && d < npes; d++)
+        {
+            long long lo = std::max(my_start, d * block), hi = std::min(my_end, (d + 1) * block);
+            if (d == rank || hi <= lo)
+                continue;
+            scounts[d] = hi - lo;
+            sdispls[d] = lo - my_start;
+            sent += hi - lo;
+            peers++;
+        }
+    }
+    if (target_end > target_start)
+    {
+        int s = (int)(std::upper_bound(starts.begin(), starts.end(), target_start) - starts.begin()) - 1;
+        for (; s < npes && starts[s] < target_end; s++)
+        {
+            long long lo = std::max(starts[s], target_start), hi = std::min(starts[s + 1], target_end);
+            if (s == rank || hi <= lo)
+                continue;
+            rcounts[s] = hi - lo;
+            rdispls[s] = lo - target_start;
+            peers++;
+        }
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    out.resize(target_end - target_start);
+    comm_trace_phase("rebalance_exchange");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_large");
+    large_pairwise_exchange((const char *)data, scounts.data(), sdispls.data(), (char *)out.data(), rcounts.data(),
+                            rdispls.data(), type, comm);
+    CALI_MARK_END("comm_large");
+    CALI_MARK_END("comm");
+
+    // The part that stays on this rank
+    long long keep_lo = std::max(my_start, target_start), keep_hi = std::min(my_end, target_end);
+    if (keep_hi > keep_lo)
+        std::copy(data + (keep_lo - my_start), data + (keep_hi - my_start), out.begin() + (keep_lo - target_start));
+
+    long long moved;
+    int max_peers;
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    MPI_Allreduce(&sent, &moved, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    MPI_Allreduce(&peers, &max_peers, 1, MPI_INT, MPI_MAX, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    cali_set_global_uint_byname("rebalance.moved_elements", (unsigned long long)moved);
+    cali_set_global_uint_byname("rebalance.max_peers", (unsigned long long)max_peers);
+    if (stats != NULL)
+    {
+        stats->n = n;
+        stats->block = block;
+        stats->moved = moved;
+        stats->max_peers = max_peers;
+    }
+}
+
+#endif
@@ -0,0 +1,470 @@
+/******************************************************************************
+ * FILE: run_codec.h
+ * DESCRIPTION:
+ *   Optional compression of int runs on the wire. Sorted runs have small
+ *   gaps between neighbours, so each run is sent as zigzag-coded deltas
+ *   bit-packed in blocks of RUN_CODEC_BLOCK values. Every block stores one
+ *   width byte, then its 128 values at that width. Runs in descending order
+ *   compress just as well because of the zigzag step.
+ *
+ *   Values are packed in 4 interleaved lanes (value i goes to lane i % 4), so
+ *   the packers, one instantiation per width, do the same shift and OR on 4
+ *   consecutive values at a time. Deltas are taken from the two neighbours
+ *   rather than a carried previous value. With GCC the pack and unpack
+ *   loops compile to SSE2 code at -O2, the delta loop at -O3 (its 127
+ *   iterations need a scalar epilogue, which -O2 does not emit). The prefix
+ *   sum that rebuilds values from the deltas stays a serial add per value.
+ *
+ *   Set SORT_COMPRESS to choose the mode:
+ *     off   (default) plain transfers
+ *     on    compress every message that gets smaller
+ *     auto  compress a message only when the predicted transfer time saved
+ *           exceeds the predicted encode + decode time
+ *   The auto mode estimates the packed size from a few sampled blocks. It
+ *   keeps running estimates of link bandwidth (from timed plain transfers,
+ *   seeded by SORT_COMPRESS_BANDWIDTH in bytes/s) and codec throughput
+ *   (from timed encodes).
+ *
+ *   The compressed_* calls mirror the large_* ones for MPI_INT data; the
+ *   receiver must pass the element count it expects, as with a plain
+ *   receive. run_codec_finalize prints the bytes saved.
+ ******************************************************************************/
+
+#ifndef RUN_CODEC_H
+#define RUN_CODEC_H
+
+#include <mpi.h>
+#include <caliper/cali.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "buffer_arena.h"
+
+#define RUN_CODEC_BLOCK 128
+// Messages smaller than this are always sent plain
+#define RUN_CODEC_MIN_BYTES 4096
+// Blocks sampled to predict the packed size in auto mode
+#define RUN_CODEC_SAMPLE_BLOCKS 8
+
+enum RunCodecMode {
+    RUN_CODEC_OFF,
+    RUN_CODEC_ON,
+    RUN_CODEC_AUTO
+};
+
+struct RunCodec {
+    bool initialized;
+    RunCodecMode mode;
+    double bandwidth;          // bytes/s of plain transfers
+    double codec_rate;         // raw bytes/s through the encoder
+    long long raw_bytes;       // payload bytes handed to compressed_* calls
+    long long wire_bytes;      // payload bytes actually sent
+    long long messages;
+    long long compressed_messages;
+};
+
+inline RunCodec &run_codec_state()
+{
+    static RunCodec state;
+    if (!state.initialized)
+    {
+        const char *mode = getenv("SORT_COMPRESS");
+        const char *bw = getenv("SORT_COMPRESS_BANDWIDTH");
+        state.initialized = true;
+        state.mode = RUN_CODEC_OFF;
+        if (mode != NULL && strcmp(mode, "on") == 0)
+            state.mode = RUN_CODEC_ON;
+        else if (mode != NULL && strcmp(mode, "auto") == 0)
+            state.mode = RUN_CODEC_AUTO;
+        state.bandwidth = bw != NULL && atof(bw) > 0 ? atof(bw) : 1e9;
+        state.codec_rate = 2e9;
+        state.raw_bytes = state.wire_bytes = 0;
+        state.messages = state.compressed_messages = 0;
+    }
+    return state;
+}
+
+inline bool run_codec_enabled()
+{
+    return run_codec_state().mode != RUN_CODEC_OFF;
+}
+
+// Worst-case packed size of count values
+inline long long run_codec_bound(long long count)
+{
+    return (count + RUN_CODEC_BLOCK - 1) / RUN_CODEC_BLOCK * (1 + RUN_CODEC_BLOCK * 4);
+}
+
+inline int run_codec_width(unsigned int v)
+{
+    int w = 0;
+    while (w < 32 && (v >> w) != 0)
+        w++;
+    return w;
+}
+
+inline unsigned int run_codec_zigzag_one(unsigned int delta)
+{
+    return (delta << 1) ^ (unsigned int)((int)delta >> 31);
+}
+
+// Zigzag deltas of the RUN_CODEC_BLOCK values at v, the first one taken
+// against prev; returns the bit width of the widest
+inline int run_codec_zigzag(const int *v, unsigned int prev, unsigned int *d)
+{
+    d[0] = run_codec_zigzag_one((unsigned int)v[0] - prev);
+    for (int i = 1; i < RUN_CODEC_BLOCK; i++)
+        d[i] = run_codec_zigzag_one((unsigned int)v[i] - (unsigned int)v[i - 1]);
+    unsigned int any = 0;
+    for (int i = 0; i < RUN_CODEC_BLOCK; i++)
+        any |= d[i];
+    return run_codec_width(any);
+}
+
+// Zigzag deltas of block b (the value before the run counts as 0); a
+// partial block is padded with its last value, i.e. zero deltas
+inline int run_codec_deltas(const int *run, long long count, long long b, unsigned int *d)
+{
+    long long begin = b * RUN_CODEC_BLOCK;
+    unsigned int prev = begin > 0 ? (unsigned int)run[begin - 1] : 0u;
+    long long n = std::min((long long)RUN_CODEC_BLOCK, count - begin);
+    if (n == RUN_CODEC_BLOCK)
+        return run_codec_zigzag(run + begin, prev, d);
+    int tail[RUN_CODEC_BLOCK];
+    std::copy(run + begin, run + begin + n, tail);
+    std::fill(tail + n, tail + RUN_CODEC_BLOCK, run[begin + n - 1]);
+    return run_codec_zigzag(tail, prev, d);
+}
+
+// Packs 128 values of W bits into 4 * W words. Lane l holds values l, l + 4,
+// ... back to back, and word j of lane l is stored at out[4 * j + l]. Each
+// step handles one value per lane, written out so it maps to 4-wide vector
+// ops.
+template <int W>
+void run_codec_pack_block(const unsigned int *d, unsigned int *out)
+{
+    memset(out, 0, 16 * W);
+    for (int k = 0; k < RUN_CODEC_BLOCK / 4; k++)
+    {
+        const int word = k * W / 32, shift = k * W % 32;
+        const unsigned int v0 = d[4 * k], v1 = d[4 * k + 1], v2 = d[4 * k + 2], v3 = d[4 * k + 3];
+        unsigned int *o = out + 4 * word;
+        o[0] |= v0 << shift;
+        o[1] |= v1 << shift;
+        o[2] |= v2 << shift;
+        o[3] |= v3 << shift;
+        if (shift + W > 32)
+        {
+            const int back = (32 - shift) & 31;
+            o[4] |= v0 >> back;
+            o[5] |= v1 >> back;
+            o[6] |= v2 >> back;
+            o[7] |= v3 >> back;
+        }
+    }
+}
+
+template <int W>
+void run_codec_unpack_block(const unsigned int *in, unsigned int *d)
+{
+    const unsigned int mask = W == 32 ? ~0u : (1u << (W & 31)) - 1;
+    for (int k = 0; k < RUN_CODEC_BLOCK / 4; k++)
+    {
+        const int word = k * W / 32, shift = k * W % 32;
+        const unsigned int *w = in + 4 * word;
+        unsigned int v0 = w[0] >> shift, v1 = w[1] >> shift, v2 = w[2] >> shift, v3 = w[3] >> shift;
+        if (shift + W > 32)
+        {
+            const int back = (32 - shift) & 31;
+            v0 |= w[4] << back;
+            v1 |= w[5] << back;
+            v2 |= w[6] << back;
+            v3 |= w[7] << back;
+        }
+        d[4 * k] = v0 & mask;
+        d[4 * k + 1] = v1 & mask;
+        d[4 * k + 2] = v2 & mask;
+        d[4 * k + 3] = v3 & mask;
+    }
+}
+
+#define RUN_CODEC_WIDTH_CASES(X)                                                                     \
+    X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17)  \
+    X(18) X(19) X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(30) X(31) X(32)
+
+// Packs block d at width w into 16 * w bytes at out (no alignment needed)
+inline void run_codec_pack(const unsigned int *d, int w, unsigned char *out)
+{
+    unsigned int words[4 * 32];
+    switch (w)
+    {
+#define RUN_CODEC_PACK_CASE(W)                                                                       \
+    case W:                                                                                          \
+        run_codec_pack_block<W>(d, words);                                                           \
+        break;
+        RUN_CODEC_WIDTH_CASES(RUN_CODEC_PACK_CASE)
+#undef RUN_CODEC_PACK_CASE
+    default:
+        return;
+    }
+    memcpy(out, words, 16 * w);
+}
+
+// Inverse of run_codec_pack
+inline void run_codec_unpack(const unsigned char *in, int w, unsigned int *d)
+{
+    unsigned int words[4 * 32];
+    memcpy(words, in, 16 * w);
+    switch (w)
+    {
+#define RUN_CODEC_UNPACK_CASE(W)                                                                     \
+    case W:                                                                                          \
+        run_codec_unpack_block<W>(words, d);                                                         \
+        break;
+        RUN_CODEC_WIDTH_CASES(RUN_CODEC_UNPACK_CASE)
+#undef RUN_CODEC_UNPACK_CASE
+    default:
+        memset(d, 0, RUN_CODEC_BLOCK * sizeof(unsigned int));
+    }
+}
+
+// Packs count values into out (at least run_codec_bound(count) bytes);
+// returns the packed size
+inline long long run_encode(const int *run, long long count, unsigned char *out)
+{
+    unsigned int d[RUN_CODEC_BLOCK];
+    unsigned char *p = out;
+    long long nblocks = (count + RUN_CODEC_BLOCK - 1) / RUN_CODEC_BLOCK;
+    for (long long b = 0; b < nblocks; b++)
+    {
+        int w = run_codec_deltas(run, count, b, d);
+        *p++ = (unsigned char)w;
+        run_codec_pack(d, w, p);
+        p += 16 * w;
+    }
+    return p - out;
+}
+
+inline void run_decode(const unsigned char *in, long long count, int *run)
+{
+    const unsigned char *p = in;
+    unsigned int d[RUN_CODEC_BLOCK];
+    unsigned int prev = 0;
+    for (long long begin = 0; begin < count; begin += RUN_CODEC_BLOCK)
+    {
+        int w = *p++;
+        run_codec_unpack(p, w, d);
+        p += 16 * w;
+        for (int i = 0; i < RUN_CODEC_BLOCK; i++)
+            d[i] = (d[i] >> 1) ^ (0u - (d[i] & 1u));
+        long long n = std::min((long long)RUN_CODEC_BLOCK, count - begin);
+        for (long long i = 0; i < n; i++)
+        {
+            prev += d[i];
+            run[begin + i] = (int)prev;
+        }
+    }
+}
+
+// Whether to compress a run of count values, per the current mode
+inline bool run_codec_worth_it(const int *run, long long count)
+{
+    RunCodec &c = run_codec_state();
+    long long raw = count * (long long)sizeof(int);
+    if (c.mode == RUN_CODEC_OFF || raw < RUN_CODEC_MIN_BYTES)
+        return false;
+    if (c.mode == RUN_CODEC_ON)
+        return true;
+
+    unsigned int d[RUN_CODEC_BLOCK];
+    long long nblocks = (count + RUN_CODEC_BLOCK - 1) / RUN_CODEC_BLOCK;
+    long long nsample = std::min(nblocks, (long long)RUN_CODEC_SAMPLE_BLOCKS);
+    long long width_sum = 0;
+    for (long long s = 0; s < nsample; s++)
+        width_sum += run_codec_deltas(run, count, s * nblocks / nsample, d);
+    double packed = nblocks * (1.0 + RUN_CODEC_BLOCK / 8.0 * width_sum / nsample);
+    double saved = (raw - packed) / c.bandwidth;
+    double cost = 2.0 * raw / c.codec_rate;
+    return saved > cost;
+}
+
+// Encodes run into out if that is worth it and makes it smaller. Returns
+// the packed size, or -1 if the run should go plain.
+inline long long run_codec_pack(const int *run, long long count, unsigned char *out)
+{
+    RunCodec &c = run_codec_state();
+    c.messages++;
+    c.raw_bytes += count * (long long)sizeof(int);
+    if (!run_codec_worth_it(run, count))
+    {
+        c.wire_bytes += count * (long long)sizeof(int);
+        return -1;
+    }
+    double t0 = MPI_Wtime();
+    long long nbytes = run_encode(run, count, out);
+    double t = MPI_Wtime() - t0;
+    if (t > 0)
+        c.codec_rate = 0.5 * c.codec_rate + 0.5 * (count * (double)sizeof(int) / t);
+    if (nbytes >= count * (long long)sizeof(int))
+    {
+        c.wire_bytes += count * (long long)sizeof(int);
+        return -1;
+    }
+    c.compressed_messages++;
+    c.wire_bytes += nbytes;
+    return nbytes;
+}
+
+// Folds a timed plain transfer into the bandwidth estimate
+inline void run_codec_observe(long long bytes, double seconds)
+{
+    RunCodec &c = run_codec_state();
+    if (bytes >= 64 * 1024 && seconds > 0)
+        c.bandwidth = 0.5 * c.bandwidth + 0.5 * (bytes / seconds);
+}
+
+// Header sent ahead of each point-to-point payload: packed size, or -1
+inline int compressed_Send(const int *buf, long long count, int dest, int tag, MPI_Comm comm)
+{
+    arena_raw_vector<unsigned char> wire(run_codec_bound(count));
+    long long nbytes = run_codec_pack(buf, count, wire.data());
+    trace_Send(&nbytes, 1, MPI_LONG_LONG, dest, tag, comm);
+    if (nbytes >= 0)
+        return large_Send(wire.data(), nbytes, MPI_BYTE, dest, tag, comm);
+    double t0 = MPI_Wtime();
+    int rc = large_Send(buf, count, MPI_INT, dest, tag, comm);
+    run_codec_observe(count * (long long)sizeof(int), MPI_Wtime() - t0);
+    return rc;
+}
+
+inline int compressed_Recv(int *buf, long long count, int source, int tag, MPI_Comm comm)
+{
+    long long nbytes;
+    trace_Recv(&nbytes, 1, MPI_LONG_LONG, source, tag, comm, MPI_STATUS_IGNORE);
+    if (nbytes < 0)
+        return large_Recv(buf, count, MPI_INT, source, tag, comm, MPI_STATUS_IGNORE);
+    arena_raw_vector<unsigned char> wire(nbytes);
+    int rc = large_Recv(wire.data(), nbytes, MPI_BYTE, source, tag, comm, MPI_STATUS_IGNORE);
+    run_decode(wire.data(), count, buf);
+    return rc;
+}
+
+// Same count in both directions, as in the bitonic exchange
+inline int compressed_Sendrecv(const int *sbuf, long long count, int dest, int stag,
+                               int *rbuf, int source, int rtag, MPI_Comm comm)
+{
+    arena_raw_vector<unsigned char> swire(run_codec_bound(count));
+    long long snbytes = run_codec_pack(sbuf, count, swire.data()), rnbytes;
+    trace_Sendrecv(&snbytes, 1, MPI_LONG_LONG, dest, stag, &rnbytes, 1, MPI_LONG_LONG, source, rtag, comm,
+                   MPI_STATUS_IGNORE);
+
+    arena_raw_vector<unsigned char> rwire(rnbytes >= 0 ? rnbytes : 0);
+    MPI_Datatype stype, rtype;
+    large_count_type(snbytes >= 0 ? snbytes : count, snbytes >= 0 ? MPI_BYTE : MPI_INT, &stype);
+    large_count_type(rnbytes >= 0 ? rnbytes : count, rnbytes >= 0 ? MPI_BYTE : MPI_INT, &rtype);
+    double t0 = MPI_Wtime();
+    int rc = trace_Sendrecv(snbytes >= 0 ? (const void *)swire.data() : (const void *)sbuf, 1, stype, dest, stag,
+                            rnbytes >= 0 ? (void *)rwire.data() : (void *)rbuf, 1, rtype, source, rtag, comm,
+                            MPI_STATUS_IGNORE);
+    if (snbytes < 0 && rnbytes < 0)
+        run_codec_observe(count * (long long)sizeof(int), MPI_Wtime() - t0);
+    MPI_Type_free(&stype);
+    MPI_Type_free(&rtype);
+    if (rnbytes >= 0)
+        run_decode(rwire.data(), count, rbuf);
+    return rc;
+}
+
+// Alltoallv of int runs. Each non-empty message starts with one mode byte
+// (1 = packed) followed by the packed or plain payload; the byte counts
+// are swapped with large_count_exchange. Runs to self are copied plain.
+inline int compressed_Alltoallv(const int *sbuf, const long long *scounts, const long long *sdispls,
+                                int *rbuf, const long long *rcounts, const long long *rdispls, MPI_Comm comm)
+{
+    int npes, myrank;
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &myrank);
+
+    std::vector<long long> wcounts(npes, 0), wdispls(npes, 0), rwcounts(npes), rwdispls(npes, 0);
+    long long total = 0;
+    for (int r = 0; r < npes; r++)
+    {
+        wdispls[r] = total;
+        if (scounts[r] > 0)
+            total += 1 + std::max(run_codec_bound(scounts[r]), scounts[r] * (long long)sizeof(int));
+    }
+    arena_raw_vector<unsigned char> wire(total);
+    for (int r = 0; r < npes; r++)
+    {
+        if (scounts[r] == 0)
+            continue;
+        unsigned char *seg = wire.data() + wdispls[r];
+        long long nbytes = r == myrank ? -1 : run_codec_pack(sbuf + sdispls[r], scounts[r], seg + 1);
+        seg[0] = nbytes >= 0 ? 1 : 0;
+        if (nbytes < 0)
+        {
+            nbytes = scounts[r] * (long long)sizeof(int);
+            memcpy(seg + 1, sbuf + sdispls[r], nbytes);
+        }
+        wcounts[r] = 1 + nbytes;
+    }
+
+    int path = large_count_exchange(wcounts.data(), wdispls.data(), rwcounts.data(), comm);
+    for (int r = 1; r < npes; r++)
+        rwdispls[r] = rwdispls[r - 1] + rwcounts[r - 1];
+    arena_raw_vector<unsigned char> rwire(rwdispls[npes - 1] + rwcounts[npes - 1]);
+
+    bool plain_only = true;
+    for (int r = 0; r < npes; r++)
+        plain_only = plain_only && (scounts[r] == 0 || wire[wdispls[r]] == 0);
+    double t0 = MPI_Wtime();
+    int rc = large_Alltoallv(wire.data(), wcounts.data(), wdispls.data(), rwire.data(), rwcounts.data(),
+                             rwdispls.data(), MPI_BYTE, comm, path);
+    if (plain_only)
+    {
+        long long sent = 0;
+        for (int r = 0; r < npes; r++)
+            sent += r == myrank ? 0 : wcounts[r];
+        run_codec_observe(sent, MPI_Wtime() - t0);
+    }
+
+    for (int r = 0; r < npes; r++)
+    {
+        if (rcounts[r] == 0)
+            continue;
+        const unsigned char *seg = rwire.data() + rwdispls[r];
+        if (seg[0] == 1)
+            run_decode(seg + 1, rcounts[r], rbuf + rdispls[r]);
+        else
+            memcpy(rbuf + rdispls[r], seg + 1, rcounts[r] * sizeof(int));
+    }
+    return rc;
+}
+
+// Collective: prints how much the compression saved and records it as
+// Caliper globals (call before the Caliper flush). Does nothing when off.
+inline void run_codec_finalize(MPI_Comm comm)
+{
+    RunCodec &c = run_codec_state();
+    if (c.mode == RUN_CODEC_OFF)
+        return;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    long long local[4] = {c.raw_bytes, c.wire_bytes, c.messages, c.compressed_messages}, global[4];
+    MPI_Reduce(local, global, 4, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    if (rank == 0)
+    {
+        cali_set_global_uint_byname("compress.raw_bytes", (unsigned long long)global[0]);
+        cali_set_global_uint_byname("compress.wire_bytes", (unsigned long long)global[1]);
+        printf("Compression (%s): %lld payload bytes sent as %lld (%.2fx), %lld of %lld messages packed\n",
+               c.mode == RUN_CODEC_ON ? "on" : "auto", global[0], global[1],
+               global[1] > 0 ? (double)global[0] / global[1] : 1.0, global[3], global[2]);
+    }
+}
+
+#endif
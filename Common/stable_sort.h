@@ -0,0 +1,159 @@
+/******************************************************************************
+ * FILE: stable_sort.h
+ * DESCRIPTION:
+ *   Helpers for the stable sort modes, where equal keys keep their original
+ *   global order (rank order, then position within the rank).
+ *
+ *   merge_sorted_runs: stable merge of consecutive sorted runs, used after an
+ *   exchange that lays received blocks out in source-rank order.
+ *
+ *   StableKeyCodec: for sorters that cannot preserve order structurally
+ *   (compare-exchange networks), a global index is attached to every key as a
+ *   tiebreak. Key and index share one word: key - key_min in the high bits,
+ *   the index in the low index_bits. When key_bits + index_bits <= 31 that
+ *   word is a plain int, so the sort runs at the same width as before. This
+ *   only happens for small key ranges: n = 2^20 leaves 11 bits, i.e. fewer
+ *   than 2048 distinct key values, and random 32-bit keys never fit. Every
+ *   other input uses the same layout in a 64-bit word (up to 63 bits).
+ *
+ *   stable_order_check verifies the result of a tiebreak sort: keys in
+ *   order and equal keys in ascending global index, across ranks too.
+ ******************************************************************************/
+
+#ifndef STABLE_SORT_H
+#define STABLE_SORT_H
+
+#include <mpi.h>
+#include <vector>
+#include <algorithm>
+#include <climits>
+
+// Stable merge of nruns sorted runs stored back to back in data; run i
+// starts at displs[i]. Pairs of neighbouring runs are merged level by level,
+// the left run winning ties. tmp is a vector of T used as scratch.
+template <typename T, typename Scratch>
+void merge_sorted_runs(T *data, const long long *displs, const long long *counts, int nruns, Scratch &tmp)
+{
+    long long total = nruns > 0 ? displs[nruns - 1] + counts[nruns - 1] : 0;
+    if (nruns <= 1 || total == 0)
+        return;
+    tmp.resize(total);
+
+    std::vector<long long> bounds(nruns + 1);
+    for (int i = 0; i < nruns; i++)
+        bounds[i] = displs[i];
+    bounds[nruns] = total;
+
+    T *src = data, *dst = tmp.data();
+    for (int width = 1; width < nruns; width *= 2)
+    {
+        for (int i = 0; i < nruns; i += 2 * width)
+        {
+            int mid = std::min(i + width, nruns);
+            int hi = std::min(i + 2 * width, nruns);
+            std::merge(src + bounds[i], src + bounds[mid], src + bounds[mid], src + bounds[hi], dst + bounds[i]);
+        }
+        std::swap(src, dst);
+    }
+    if (src != data)
+        std::copy(src, src + total, data);
+}
+
+struct StableKeyCodec
+{
+    long long key_min;      // smallest key on any rank
+    int key_bits;           // bits for key - key_min
+    int index_bits;         // bits for the global index
+    bool packed;            // true: key and index fit in one non-negative int
+    long long first_index;  // global index of this rank's first element
+};
+
+inline int stable_bits_for(unsigned long long v)
+{
+    int bits = 0;
+    while (bits < 64 && (v >> bits) != 0)
+        bits++;
+    return bits;
+}
+
+// Collective. Returns false if even a 64-bit composite cannot hold the
+// key range and the element count.
+inline bool stable_codec_init(StableKeyCodec &c, const int *keys, long long nlocal, MPI_Comm comm)
+{
+    long long local[2] = {LLONG_MIN, LLONG_MIN}, global[2];
+    for (long long i = 0; i < nlocal; i++)
+    {
+        local[0] = std::max(local[0], -(long long)keys[i]);
+        local[1] = std::max(local[1], (long long)keys[i]);
+    }
+    MPI_Allreduce(local, global, 2, MPI_LONG_LONG, MPI_MAX, comm);
+
+    long long n, before = 0;
+    MPI_Allreduce(&nlocal, &n, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    MPI_Exscan(&nlocal, &before, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    c.key_min = n > 0 ? -global[0] : 0;
+    c.key_bits = n > 0 ? stable_bits_for((unsigned long long)(global[1] - c.key_min)) : 0;
+    c.index_bits = stable_bits_for(n > 0 ? (unsigned long long)(n - 1) : 0);
+    c.packed = c.key_bits + c.index_bits <= 31;
+    c.first_index = rank == 0 ? 0 : before;
+    return c.key_bits + c.index_bits <= 63;
+}
+
+inline int stable_pack32(const StableKeyCodec &c, int key, long long index)
+{
+    return (int)(((long long)key - c.key_min) << c.index_bits | index);
+}
+
+inline long long stable_pack64(const StableKeyCodec &c, int key, long long index)
+{
+    return ((long long)key - c.key_min) << c.index_bits | index;
+}
+
+inline int stable_key(const StableKeyCodec &c, long long packed)
+{
+    return (int)((packed >> c.index_bits) + c.key_min);
+}
+
+inline long long stable_index(const StableKeyCodec &c, long long packed)
+{
+    return packed & ((1LL << c.index_bits) - 1);
+}
+
+// Collective. True on every rank if keys[0..n) are sorted and equal keys
+// carry ascending indices, within each rank and across rank boundaries
+// (rank order is global order).
+inline bool stable_order_check(const int *keys, const long long *indices, long long n, MPI_Comm comm)
+{
+    int ok = 1;
+    for (long long i = 1; i < n && ok; i++)
+        ok = keys[i - 1] < keys[i] || (keys[i - 1] == keys[i] && indices[i - 1] < indices[i]);
+
+    // Both ends of every rank: non-empty flag, first key/index, last key/index
+    int npes, rank;
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &rank);
+    long long ends[5] = {n > 0, n > 0 ? keys[0] : 0, n > 0 ? indices[0] : 0, n > 0 ? keys[n - 1] : 0,
+                         n > 0 ? indices[n - 1] : 0};
+    std::vector<long long> all_ends(5 * (size_t)npes);
+    MPI_Allgather(ends, 5, MPI_LONG_LONG, all_ends.data(), 5, MPI_LONG_LONG, comm);
+    if (n > 0)
+    {
+        for (int r = rank - 1; r >= 0; r--)
+        {
+            const long long *prev = &all_ends[5 * (size_t)r];
+            if (!prev[0])
+                continue;
+            if (prev[3] > ends[1] || (prev[3] == ends[1] && prev[4] >= ends[2]))
+                ok = 0;
+            break;
+        }
+    }
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, comm);
+    return all_ok != 0;
+}
+
+#endif
@@ -0,0 +1,400 @@
+/******************************************************************************
+ * FILE: histogram_sort.cpp
+ * DESCRIPTION:
+ *   MPI implementation of Histogram Sort with Caliper instrumentation.
+ *   Splitters are refined iteratively: every round each rank counts its local
+ *   keys below every candidate splitter by binary search over its sorted
+ *   block, an Allreduce sums the counts, and candidates that are not yet
+ *   within the tolerance of their target rank are bisected. The data is only
+ *   exchanged once, after all splitters have converged.
+ *
+ *   Usage: mpirun -np <p> ./histogramsort <n> [tolerance] [input_type] [stable] [rebalance]
+ *     tolerance  allowed bucket deviation as a fraction of n/p (default 0.01,
+ *                0 gives exact n/p buckets)
+ *     input_type random | sorted (default random)
+ *     stable     keep equal keys in their global input order
+ *     rebalance  move the sorted buckets into exact ceil(n/p) blocks, which
+ *                lets a loose tolerance save refinement rounds
+ ******************************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+#include <cstdlib>
+#include <string>
+#include <caliper/cali.h>
+#include <caliper/cali-manager.h>
+#include <climits>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "stable_sort.h"
+#include "buffer_arena.h"
+#include "run_codec.h"
+#include "rebalance.h"
+
+// Upper bound on refinement rounds; bisection over 32-bit keys needs at most 33
+#define HISTOGRAM_MAX_ROUNDS 64
+
+// With stable set the local sort is stable, ties on a splitter are already
+// handed out in rank order, and the received runs are merged in source-rank
+// order, so equal keys keep their global input order.
+int* HistogramSort(long long nlocal, int* elmnts, long long* nsorted, double tolerance, int* rounds, MPI_Comm comm,
+                   bool stable = false) {
+    int i, npes, myrank;
+
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &myrank);
+
+    // Windows wider than half a bucket could let neighbouring splitters cross
+    if (tolerance < 0.0)
+        tolerance = 0.0;
+    if (tolerance > 0.49)
+        tolerance = 0.49;
+
+    // Sort local array using std::sort
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_large");
+    if (stable)
+        std::stable_sort(elmnts, elmnts + nlocal);
+    else
+        std::sort(elmnts, elmnts + nlocal);
+    CALI_MARK_END("comp_large");
+    CALI_MARK_END("comp");
+
+    // Global size and key range
+    long long local_n = nlocal, n;
+    long long local_range[2], global_range[2];
+    local_range[0] = nlocal > 0 ? -(long long)elmnts[0] : LLONG_MIN;
+    local_range[1] = nlocal > 0 ? (long long)elmnts[nlocal - 1] : LLONG_MIN;
+    comm_trace_phase("histogram_setup");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Allreduce(&local_n, &n, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    trace_Allreduce(local_range, global_range, 2, MPI_LONG_LONG, MPI_MAX, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    // Nothing to sort anywhere (and no key range to bisect)
+    if (n == 0) {
+        *nsorted = 0;
+        *rounds = 0;
+        return new int[1];
+    }
+
+    int nsplit = npes - 1;
+    std::vector<long long> target(nsplit), lo(nsplit), hi(nsplit), lo_count(nsplit), hi_count(nsplit);
+    std::vector<long long> cand(nsplit), local_counts(nsplit), global_counts(nsplit);
+    std::vector<long long> split_key(nsplit), split_take(nsplit);
+    std::vector<char> done(nsplit, 0);
+    // Each bucket is bounded by two splitters that may miss their targets in
+    // opposite directions, so each gets half the allowed bucket deviation
+    long long tol_count = (long long)(tolerance * (double)n / npes / 2);
+
+    // Invariant: count(keys < lo) <= target <= count(keys < hi)
+    for (i = 0; i < nsplit; i++) {
+        target[i] = (long long)(i + 1) * n / npes;
+        lo[i] = -global_range[0];
+        hi[i] = global_range[1] + 1;
+        lo_count[i] = 0;
+        hi_count[i] = n;
+    }
+
+    // First-round candidates come from regular samples, like SampleSort
+    std::vector<int> samples(nsplit), allpicks((size_t)npes * nsplit);
+    for (i = 0; i < nsplit; i++)
+        samples[i] = nlocal > 0 ? elmnts[(long long)(i + 1) * nlocal / npes] : INT_MAX;
+    comm_trace_phase("histogram_samples");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Allgather(samples.data(), nsplit, MPI_INT, allpicks.data(), nsplit, MPI_INT, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    std::sort(allpicks.begin(), allpicks.end());
+    for (i = 0; i < nsplit; i++)
+        cand[i] = allpicks[(size_t)(i + 1) * npes - 1];
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    // Refine until every splitter is within tolerance of its target
+    comm_trace_phase("histogram_rounds");
+    int round = 0;
+    int remaining = nsplit;
+    while (remaining > 0 && round < HISTOGRAM_MAX_ROUNDS) {
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        for (i = 0; i < nsplit; i++) {
+            if (done[i]) {
+                local_counts[i] = 0;
+                continue;
+            }
+            if (cand[i] <= lo[i] || cand[i] >= hi[i])
+                cand[i] = lo[i] + (hi[i] - lo[i]) / 2;
+            local_counts[i] = std::lower_bound(elmnts, elmnts + nlocal, cand[i],
+                                  [](int a, long long b) { return (long long)a < b; }) - elmnts;
+        }
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+
+        CALI_MARK_BEGIN("comm");
+        CALI_MARK_BEGIN("comm_small");
+        trace_Allreduce(local_counts.data(), global_counts.data(), nsplit, MPI_LONG_LONG, MPI_SUM, comm);
+        CALI_MARK_END("comm_small");
+        CALI_MARK_END("comm");
+
+        // Every rank sees the same global counts, so every rank derives the
+        // same next candidates and no broadcast is needed
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        for (i = 0; i < nsplit; i++) {
+            if (done[i])
+                continue;
+            long long g = global_counts[i];
+            if (g >= target[i] - tol_count && g <= target[i] + tol_count) {
+                split_key[i] = cand[i];
+                split_take[i] = 0;
+                done[i] = 1;
+                remaining--;
+                continue;
+            }
+            if (g < target[i]) {
+                lo[i] = cand[i];
+                lo_count[i] = g;
+            } else {
+                hi[i] = cand[i];
+                hi_count[i] = g;
+            }
+            if (hi[i] - lo[i] <= 1) {
+                // Only copies of lo straddle the target; split them by rank order
+                split_key[i] = lo[i];
+                split_take[i] = target[i] - lo_count[i];
+                done[i] = 1;
+                remaining--;
+                continue;
+            }
+            cand[i] = lo[i] + (hi[i] - lo[i]) / 2;
+        }
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+        round++;
+    }
+    *rounds = round;
+
+    // Splitters that ran out of rounds fall back to their lower bound
+    for (i = 0; i < nsplit; i++) {
+        if (!done[i]) {
+            split_key[i] = lo[i];
+            split_take[i] = target[i] - lo_count[i];
+        }
+    }
+
+    // Local bucket boundaries; ties on a splitter key are handed out in rank order
+    std::vector<long long> local_eq(nsplit), eq_before(nsplit, 0);
+    std::vector<long long> boundary(npes + 1);
+    boundary[0] = 0;
+    boundary[npes] = nlocal;
+    for (i = 0; i < nsplit; i++) {
+        auto range = std::equal_range(elmnts, elmnts + nlocal, split_key[i],
+                         [](const long long& a, const long long& b) { return a < b; });
+        boundary[i + 1] = range.first - elmnts;
+        local_eq[i] = range.second - range.first;
+    }
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    MPI_Exscan(local_eq.data(), eq_before.data(), nsplit, MPI_LONG_LONG, MPI_SUM, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    if (myrank == 0)
+        std::fill(eq_before.begin(), eq_before.end(), 0);
+    for (i = 0; i < nsplit; i++) {
+        long long take = split_take[i] - eq_before[i];
+        take = std::max(0LL, std::min(take, local_eq[i]));
+        boundary[i + 1] += take;
+        boundary[i + 1] = std::max(boundary[i + 1], boundary[i]);
+    }
+
+    std::vector<long long> scounts(npes), sdispls(npes), rcounts(npes), rdispls(npes);
+    for (i = 0; i < npes; i++) {
+        scounts[i] = boundary[i + 1] - boundary[i];
+        sdispls[i] = boundary[i];
+    }
+
+    // Single data exchange with the converged splitters
+    comm_trace_phase("bucket_counts");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    int path = large_count_exchange(scounts.data(), sdispls.data(), rcounts.data(), comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    rdispls[0] = 0;
+    for (i = 1; i < npes; i++)
+        rdispls[i] = rdispls[i - 1] + rcounts[i - 1];
+    *nsorted = rdispls[npes - 1] + rcounts[npes - 1];
+    int* sorted_elmnts = new int[*nsorted > 0 ? *nsorted : 1];
+
+    comm_trace_phase("bucket_exchange");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_large");
+    // Buckets are sorted runs, so they compress well (SORT_COMPRESS)
+    if (run_codec_enabled())
+        compressed_Alltoallv(elmnts, scounts.data(), sdispls.data(),
+                             sorted_elmnts, rcounts.data(), rdispls.data(), comm);
+    else
+        large_Alltoallv(elmnts, scounts.data(), sdispls.data(),
+                        sorted_elmnts, rcounts.data(), rdispls.data(), MPI_INT, comm, path);
+    CALI_MARK_END("comm_large");
+    CALI_MARK_END("comm");
+
+    // Perform the final local sort
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_large");
+    if (stable) {
+        arena_vector<int> merge_tmp;
+        merge_sorted_runs(sorted_elmnts, rdispls.data(), rcounts.data(), npes, merge_tmp);
+    } else {
+        std::sort(sorted_elmnts, sorted_elmnts + (*nsorted));
+    }
+    CALI_MARK_END("comp_large");
+    CALI_MARK_END("comp");
+
+    return sorted_elmnts;
+}
+
+int main(int argc, char* argv[]) {
+    CALI_CXX_MARK_FUNCTION;
+    long long n;
+    int npes;
+    int myrank;
+    long long nlocal;
+    int* elmnts;  /* array that stores the local elements */
+    int* vsorted; /* array that stores the final sorted elements */
+    long long nsorted;  /* number of elements in vsorted */
+    int rounds;
+    double tolerance = 0.01;
+    std::string input_type = "random";
+    double stime, etime;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &npes);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+
+    cali::ConfigManager mgr;
+    mgr.start();
+
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
+    if (argc < 2) {
+        if (myrank == 0) {
+            std::cout << "Usage: mpiexec -n <p> " << argv[0] << " <n> [tolerance] [input_type] [stable] [rebalance]" << std::endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    n = atoll(argv[1]);
+    if (argc >= 3)
+        tolerance = atof(argv[2]);
+    if (argc >= 4)
+        input_type = argv[3];
+    bool stable = false, rebalance = false;
+    for (int a = 4; a < argc; a++) {
+        if (std::string(argv[a]) == "stable")
+            stable = true;
+        else if (std::string(argv[a]) == "rebalance")
+            rebalance = true;
+    }
+    nlocal = n / npes; /* Compute the number of elements to be stored locally. */
+
+    elmnts = new int[nlocal > 0 ? nlocal : 1];
+
+    CALI_MARK_BEGIN("data_init_runtime");
+    srand(myrank);
+    if (input_type == "sorted") {
+        int current_value = rand() % (10 * n + 1);
+        for (long long i = 0; i < nlocal; i++) {
+            elmnts[i] = current_value;
+            current_value += rand() % 10;
+        }
+    } else {
+        for (long long i = 0; i < nlocal; i++) {
+            elmnts[i] = rand() % (10 * n + 1);
+        }
+    }
+    CALI_MARK_END("data_init_runtime");
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+
+    vsorted = HistogramSort(nlocal, elmnts, &nsorted, tolerance, &rounds, MPI_COMM_WORLD, stable);
+
+    etime = MPI_Wtime();
+
+    RebalanceStats rebalance_stats;
+    double rebalance_time = 0;
+    if (rebalance) {
+        arena_vector<int> blocks;
+        double rtime = MPI_Wtime();
+        CALI_MARK_BEGIN("rebalance");
+        rebalance_blocks(vsorted, nsorted, blocks, MPI_INT, MPI_COMM_WORLD, &rebalance_stats);
+        CALI_MARK_END("rebalance");
+        rebalance_time = MPI_Wtime() - rtime;
+        delete[] vsorted;
+        nsorted = (long long)blocks.size();
+        vsorted = new int[nsorted > 0 ? nsorted : 1];
+        std::copy(blocks.begin(), blocks.end(), vsorted);
+    }
+
+    CALI_MARK_BEGIN("correctness_check");
+    // Local order plus order across each rank boundary
+    int local_ok = std::is_sorted(vsorted, vsorted + nsorted) ? 1 : 0;
+    int last = nsorted > 0 ? vsorted[nsorted - 1] : INT_MIN;
+    int prev_max = INT_MIN;
+    MPI_Exscan(&last, &prev_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (myrank > 0 && nsorted > 0 && prev_max > vsorted[0])
+        local_ok = 0;
+    int all_ok;
+    MPI_Reduce(&local_ok, &all_ok, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+
+    long long min_sorted, max_sorted, total_sorted;
+    MPI_Reduce(&nsorted, &min_sorted, 1, MPI_LONG_LONG, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&nsorted, &max_sorted, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&nsorted, &total_sorted, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (myrank == 0) {
+        std::cout << "Total sorted elements: " << total_sorted << std::endl;
+        std::cout << "Expected sorted elements: " << nlocal * npes << std::endl;
+        std::cout << "Refinement rounds: " << rounds << std::endl;
+        std::cout << "Bucket sizes: min " << min_sorted << ", max " << max_sorted
+                  << ", target " << nlocal << std::endl;
+        std::cout << "Is the sorted array valid? " << (all_ok ? "Yes" : "No") << std::endl;
+        std::cout << "Sorting time: " << etime - stime << " sec" << std::endl;
+        if (rebalance) {
+            std::cout << "Rebalance: moved " << rebalance_stats.moved << " of " << rebalance_stats.n
+                      << " elements into blocks of " << rebalance_stats.block << ", at most "
+                      << rebalance_stats.max_peers << " peers per rank" << std::endl;
+            std::cout << "Rebalance time: " << rebalance_time << " sec" << std::endl;
+        }
+    }
+    CALI_MARK_END("correctness_check");
+
+    delete[] elmnts;
+    delete[] vsorted;
+
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+    run_codec_finalize(MPI_COMM_WORLD);
+
+    mgr.stop();
+    mgr.flush();
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -7,6 +7,12 @@
 #include <string>
 #include <cstdlib>
 #include <cstring>
+#include <cstdio>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "buffer_arena.h"
+#include "run_codec.h"
+#include "rebalance.h"
 
 using namespace std;
 
@@ -21,6 +27,12 @@ int main(int argc, char *argv[]) {
     cali_init();
     adiak::init(NULL);
 
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
     // Get the rank and size of the MPI world
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -33,6 +45,8 @@ int main(int argc, char *argv[]) {
     int dataTypeSize = sizeof(int);
     long long inputSize = 0;
     string inputType = "Random"; // Default input type
+    bool stable = false; // Keep equal keys in input order
+    bool rebalance = false; // Spread the result from rank 0 into ceil(n/p) blocks
     int numProcs = size;
     string scalability = "strong"; // Adjust if needed
     int groupNumber = 21; // Your group number
@@ -44,9 +58,16 @@ int main(int argc, char *argv[]) {
         if (argc >= 3) {
             inputType = argv[2];
         }
+        for (int a = 3; a < argc; a++) {
+            if (string(argv[a]) == "stable") {
+                stable = true;
+            } else if (string(argv[a]) == "rebalance") {
+                rebalance = true;
+            }
+        }
     } else {
         if (rank == 0) {
-            cerr << "Usage: " << argv[0] << " input_size [input_type]" << endl;
+            cerr << "Usage: " << argv[0] << " input_size [input_type] [stable] [rebalance]" << endl;
         }
         MPI_Finalize();
         return EXIT_FAILURE;
@@ -90,16 +111,18 @@ int main(int argc, char *argv[]) {
     adiak::value("scalability", scalability);
     adiak::value("group_num", groupNumber);
     adiak::value("implementation_source", implementationSource);
+    adiak::value("stable", stable ? 1 : 0);
+    adiak::value("rebalance", rebalance ? 1 : 0);
 
     // Initialize local data variables
-    vector<int> localData;
-    int localSize = 0;
+    arena_vector<int> localData;
+    long long localSize = 0;
 
     // Data initialization on root process
     CALI_MARK_BEGIN("data_init_runtime");
     vector<int> data;
-    vector<int> sendCounts(size);
-    vector<int> displacements(size);
+    vector<long long> sendCounts(size);
+    vector<long long> displacements(size);
 
     if (rank == 0) {
         data.resize(inputSize);
@@ -121,9 +144,9 @@ int main(int argc, char *argv[]) {
             for (long long i = 0; i < inputSize; ++i) {
                 data[i] = i;
             }
-            int numSwaps = inputSize / 100;
+            long long numSwaps = inputSize / 100;
             srand(42);
-            for (int i = 0; i < numSwaps; ++i) {
+            for (long long i = 0; i < numSwaps; ++i) {
                 long long idx1 = rand() % inputSize;
                 long long idx2 = rand() % inputSize;
                 swap(data[idx1], data[idx2]);
@@ -154,57 +177,78 @@ int main(int argc, char *argv[]) {
     CALI_MARK_END("data_init_runtime");
 
     // Broadcast sendCounts to all processes (small communication, not annotated)
-    MPI_Bcast(sendCounts.data(), size, MPI_INT, 0, MPI_COMM_WORLD);
+    comm_trace_phase("scatter");
+    trace_Bcast(sendCounts.data(), size, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
     localSize = sendCounts[rank];
     localData.resize(localSize);
 
     // Distribute data among processes
     CALI_MARK_BEGIN("comm");
-    MPI_Scatterv(rank == 0 ? data.data() : NULL, sendCounts.data(), displacements.data(), MPI_INT,
-                 localData.data(), localSize, MPI_INT, 0, MPI_COMM_WORLD);
+    large_Scatterv(rank == 0 ? data.data() : NULL, sendCounts.data(), displacements.data(),
+                   localData.data(), localSize, MPI_INT, 0, MPI_COMM_WORLD);
     CALI_MARK_END("comm");
 
-    // Perform local sorting
+    // Perform local sorting; std::merge below already takes ties from the
+    // lower-ranked run first, so a stable local sort makes the whole sort stable
     CALI_MARK_BEGIN("comp_large");
-    sort(localData.begin(), localData.end());
+    if (stable) {
+        stable_sort(localData.begin(), localData.end());
+    } else {
+        sort(localData.begin(), localData.end());
+    }
     CALI_MARK_END("comp_large");
 
     // Merging phase
     int active = 1;
     int step = 1;
     while (step < size) {
+        // One trace phase per tree level so the serial merge tree shows up level by level
+        char phaseName[32];
+        snprintf(phaseName, sizeof(phaseName), "merge_step_%d", step);
+        comm_trace_phase(phaseName);
         if (active) {
             if (rank % (2 * step) == 0) {
                 if (rank + step < size) {
-                    // Exchange sizes with neighbor (small communication, not annotated)
-                    int recvSize;
-                    MPI_Sendrecv(&localSize, 1, MPI_INT, rank + step, 0,
-                                 &recvSize, 1, MPI_INT, rank + step, 0,
+                    // Receive the neighbor's size (small communication, not annotated).
+                    // Nothing is sent back: the neighbor never receives it, and an
+                    // unmatched message would be picked up by a later receive
+                    long long recvSize;
+                    trace_Sendrecv(NULL, 0, MPI_LONG_LONG, MPI_PROC_NULL, 0,
+                                 &recvSize, 1, MPI_LONG_LONG, rank + step, 0,
                                  MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
                     // Receive data from neighbor
-                    vector<int> recvData(recvSize);
+                    arena_vector<int> recvData(recvSize);
                     CALI_MARK_BEGIN("comm");
-                    MPI_Recv(recvData.data(), recvSize, MPI_INT, rank + step, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    if (run_codec_enabled()) {
+                        compressed_Recv(recvData.data(), recvSize, rank + step, 0, MPI_COMM_WORLD);
+                    } else {
+                        large_Recv(recvData.data(), recvSize, MPI_INT, rank + step, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    }
                     CALI_MARK_END("comm");
 
                     // Merge data
                     CALI_MARK_BEGIN("comp_large");
-                    vector<int> mergedData(localSize + recvSize);
+                    arena_vector<int> mergedData(localSize + recvSize);
                     merge(localData.begin(), localData.end(), recvData.begin(), recvData.end(), mergedData.begin());
-                    localData = mergedData;
+                    localData.swap(mergedData);
                     localSize = localData.size();
                     CALI_MARK_END("comp_large");
                 }
             } else if (rank % (2 * step) == step) {
                 // Send size to neighbor (small communication, not annotated)
-                MPI_Sendrecv(&localSize, 1, MPI_INT, rank - step, 0,
-                             NULL, 0, MPI_INT, MPI_PROC_NULL, 0,
+                trace_Sendrecv(&localSize, 1, MPI_LONG_LONG, rank - step, 0,
+                             NULL, 0, MPI_LONG_LONG, MPI_PROC_NULL, 0,
                              MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
                 // Send data to neighbor
                 CALI_MARK_BEGIN("comm");
-                MPI_Send(localData.data(), localSize, MPI_INT, rank - step, 0, MPI_COMM_WORLD);
+                // Runs are sorted, so they compress well (SORT_COMPRESS)
+                if (run_codec_enabled()) {
+                    compressed_Send(localData.data(), localSize, rank - step, 0, MPI_COMM_WORLD);
+                } else {
+                    large_Send(localData.data(), localSize, MPI_INT, rank - step, 0, MPI_COMM_WORLD);
+                }
                 CALI_MARK_END("comm");
                 active = 0; // Process becomes inactive
             }
@@ -239,6 +283,27 @@ int main(int argc, char *argv[]) {
         CALI_MARK_END("correctness_check");
     }
 
+    // The merge tree leaves everything on rank 0; hand every rank its block
+    if (rebalance) {
+        arena_vector<int> block;
+        RebalanceStats stats;
+        double rtime = MPI_Wtime();
+        CALI_MARK_BEGIN("rebalance");
+        rebalance_blocks(localData.data(), rank == 0 ? localSize : 0, block, MPI_INT, MPI_COMM_WORLD, &stats);
+        CALI_MARK_END("rebalance");
+        rtime = MPI_Wtime() - rtime;
+        localData.swap(block);
+        localSize = localData.size();
+        if (rank == 0) {
+            cout << "Rebalance: moved " << stats.moved << " of " << stats.n << " elements into blocks of "
+                 << stats.block << ", " << rtime << " sec" << endl;
+        }
+    }
+
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+    run_codec_finalize(MPI_COMM_WORLD);
+
     // Finalize Adiak and Caliper
     adiak::fini();
 
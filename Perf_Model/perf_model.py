@@ -0,0 +1,551 @@
+#!/usr/bin/env python3
+
+# Analytical performance model for the MPI sorters, fitted from the Caliper
+# (.cali) files the sorters already write.
+#
+# Each run's sorting time is split into communication (outermost comm*
+# regions), computation (outermost comp* regions) and the rest (barriers,
+# skew). Per algorithm, and per input type when there are enough runs, the
+# three parts are fitted to LogGP-style terms:
+#   comm  = L * messages(n, p) + G * bytes(n, p)
+#   comp  = sum of c_* * work(n, p), e.g. c_sort * (n/p) log2(n/p)
+#   other = o + o_log * log2(p)
+# with non-negative coefficients, minimizing relative error. Runs without
+# comm/comp regions are fitted as a whole with all terms. The message, byte
+# and work counts per algorithm are in FEATURES below.
+#
+# Usage:
+#   python3 perf_model.py runs <cali dirs...>
+#   python3 perf_model.py fit <cali dirs...> [-o model.json]
+#   python3 perf_model.py predict model.json <algorithm> <n> [input_type] [--procs 2,4,...]
+#   python3 perf_model.py validate <cali dirs...> [--holdout largest-n|largest-p|random]
+#
+# Runs missing adiak metadata take algorithm, n, p and input type from the
+# directory and file names (p<procs>-a<n>[-t<type>].cali).
+
+import argparse
+import itertools
+import json
+import math
+import os
+import random
+import re
+import sys
+
+# ---------------------------------------------------------------------------
+# .cali reader
+
+def split_unescaped(s, sep):
+    out, cur, i = [], [], 0
+    while i < len(s):
+        c = s[i]
+        if c == "\\" and i + 1 < len(s):
+            cur.append(s[i + 1])
+            i += 2
+            continue
+        if c == sep:
+            out.append("".join(cur))
+            cur = []
+        else:
+            cur.append(c)
+        i += 1
+    out.append("".join(cur))
+    return out
+
+
+def read_cali(path):
+    """Returns (globals dict, list of (region path tuple, metrics dict))."""
+    nodes, ctx_recs, global_recs = {}, [], []
+    with open(path, encoding="utf-8", errors="replace") as f:
+        for line in f:
+            if not line.startswith("__rec="):
+                continue
+            fields = {}
+            for kv in split_unescaped(line.rstrip("\n"), ","):
+                k, _, v = kv.partition("=")
+                fields[k] = v
+            rec = fields.get("__rec")
+            if rec == "node":
+                parent = int(fields["parent"]) if "parent" in fields else None
+                nodes[int(fields["id"])] = (int(fields["attr"]), fields.get("data", ""), parent)
+            elif rec == "ctx":
+                ctx_recs.append(fields)
+            elif rec == "globals":
+                global_recs.append(fields)
+
+    # Attribute ids are the ids of nodes carrying cali.attribute.name (attr 8)
+    names = {i: data for i, (attr, data, _) in nodes.items() if attr == 8}
+
+    def chain(node_id):
+        out = []
+        while node_id is not None and node_id in nodes:
+            attr, data, parent = nodes[node_id]
+            out.append((names.get(attr, str(attr)), data))
+            node_id = parent
+        return out[::-1]
+
+    meta = {}
+    for g in global_recs:
+        for ref in g.get("ref", "").split("="):
+            if ref:
+                for name, data in chain(int(ref)):
+                    meta.setdefault(name, data)
+
+    records = []
+    for c in ctx_recs:
+        path = []
+        for ref in c.get("ref", "").split("="):
+            if ref:
+                path += [data for name, data in chain(int(ref)) if name in ("region", "mpi.function")]
+        attrs = [names.get(int(a), a) for a in split_unescaped(c.get("attr", ""), "=") if a]
+        values = split_unescaped(c.get("data", ""), "=")
+        metrics = {}
+        for a, v in zip(attrs, values):
+            try:
+                metrics[a] = float(v)
+            except ValueError:
+                pass
+        records.append((tuple(path), metrics))
+    return meta, records
+
+# ---------------------------------------------------------------------------
+# Runs
+
+ALGORITHM_ALIASES = {"bitonic": "bitonic", "merge": "merge", "radix": "radix", "sample": "sample",
+                     "histogram": "histogram"}
+SETUP_REGIONS = ("data_init_runtime", "array_creation", "correctness_check", "sort_validation")
+TIME_METRICS = ("max#inclusive#sum#time.duration", "avg#inclusive#sum#time.duration",
+                "sum#inclusive#sum#time.duration")
+
+
+def normalize_algorithm(name):
+    name = (name or "").lower()
+    for key, alg in ALGORITHM_ALIASES.items():
+        if key in name:
+            return alg
+    return None
+
+
+def normalize_input_type(name):
+    name = (name or "").lower()
+    if "perturb" in name or "nearly" in name:
+        return "perturbed"
+    if "reverse" in name:
+        return "reverse"
+    if "sorted" in name:
+        return "sorted"
+    if "random" in name:
+        return "random"
+    return None
+
+
+def region_family(name):
+    name = name.lower()
+    if name.startswith("comm"):
+        return "comm"
+    if name.startswith("comp"):
+        return "comp"
+    return None
+
+
+def load_run(path):
+    meta, records = read_cali(path)
+
+    # Fall back on the file and directory names for missing metadata
+    base = os.path.basename(path)
+    m = re.match(r"p(\d+)-a(\d+)(?:-t([A-Za-z0-9_]+))?", base)
+    algorithm = normalize_algorithm(meta.get("algorithm")) or normalize_algorithm(path)
+    input_type = normalize_input_type(meta.get("input_type")) or normalize_input_type(
+        (m.group(3) if m and m.group(3) else "") + " " + os.path.dirname(path))
+    try:
+        p = int(meta.get("num_procs") or meta.get("mpi.world.size"))
+    except (TypeError, ValueError):
+        p = int(m.group(1)) if m else None
+    try:
+        n = int(meta.get("input_size"))
+    except (TypeError, ValueError):
+        n = int(m.group(2)) if m else None
+    if n is not None and n < 64:
+        n = 2 ** n  # sizes given as exponents (a16 = 2^16)
+    if not algorithm or not p or not n:
+        return None
+
+    def time_of(metrics):
+        for key in TIME_METRICS:
+            if key in metrics:
+                return metrics[key]
+        return None
+
+    main = setup = comm = comp = 0.0
+    found_main = found_split = False
+    for path_regions, metrics in records:
+        t = time_of(metrics)
+        if t is None or not path_regions:
+            continue
+        if path_regions == ("main",):
+            main, found_main = t, True
+            continue
+        leaf = path_regions[-1]
+        ancestors = path_regions[:-1]
+        if any(a in SETUP_REGIONS for a in ancestors):
+            continue
+        if leaf in SETUP_REGIONS:
+            setup += t
+            continue
+        family = region_family(leaf)
+        if family and not any(region_family(a) for a in ancestors):
+            found_split = True
+            if family == "comm":
+                comm += t
+            else:
+                comp += t
+    if not found_main:
+        return None
+    total = max(main - setup, 1e-9)
+    run = {"file": path, "algorithm": algorithm, "input_type": input_type or "random", "n": n, "p": p,
+           "total": total}
+    if found_split:
+        # Root-based distribution (scatter after rank 0 fills the array)
+        # waits out data_init_runtime inside a comm region; that time is
+        # already excluded from the total, so drop it from comm as well
+        comm = max(min(comm, total - comp), 0.0)
+        run["comm"] = comm
+        run["comp"] = comp
+        run["other"] = max(total - comm - comp, 0.0)
+    return run
+
+
+def load_runs(dirs):
+    runs = {}
+    for d in dirs:
+        for root, _, files in os.walk(d):
+            for fn in sorted(files):
+                if not fn.endswith(".cali"):
+                    continue
+                try:
+                    run = load_run(os.path.join(root, fn))
+                except (OSError, ValueError, KeyError) as e:
+                    print(f"skipping {os.path.join(root, fn)}: {e}", file=sys.stderr)
+                    continue
+                if run is None:
+                    continue
+                # Repeated configurations (copies in several folders) keep the fastest
+                key = (run["algorithm"], run["input_type"], run["n"], run["p"])
+                if key not in runs or run["total"] < runs[key]["total"]:
+                    runs[key] = run
+    return list(runs.values())
+
+# ---------------------------------------------------------------------------
+# Model terms: name -> function of (n, p). Counts are per rank on the
+# critical path; keys are 4-byte ints.
+
+def lg(x):
+    return math.log2(x) if x > 1 else 0.0
+
+
+def bitonic_steps(p):
+    return lg(p) * (lg(p) + 1) / 2
+
+
+def radix_digits(n):
+    return max(1, len(str(n)))
+
+
+FEATURES = {
+    # Binary merge tree: log p levels, the root receives and merges ~n keys
+    "merge": {
+        "comm": {"L": lambda n, p: lg(p), "G": lambda n, p: 4.0 * n * (1 - 1.0 / p)},
+        "comp": {"c_sort": lambda n, p: (n / p) * lg(n / p), "c_merge": lambda n, p: n * (1 - 1.0 / p)},
+    },
+    # log p (log p + 1) / 2 partner exchanges of a whole block
+    "bitonic": {
+        "comm": {"L": lambda n, p: bitonic_steps(p), "G": lambda n, p: 4.0 * (n / p) * bitonic_steps(p)},
+        "comp": {"c_sort": lambda n, p: (n / p) * lg(n / p) ** 2,
+                 "c_compare": lambda n, p: (n / p) * bitonic_steps(p)},
+    },
+    # Sample allgather, count alltoall, bucket alltoallv
+    "sample": {
+        "comm": {"L": lambda n, p: p + lg(p), "G": lambda n, p: 4.0 * (n / p) + 4.0 * p * p},
+        "comp": {"c_sort": lambda n, p: 2 * (n / p) * lg(n / p), "c_partition": lambda n, p: n / p,
+                 "c_compare": lambda n, p: p * p * lg(p * p)},
+    },
+    # Splitter refinement rounds of Allreduces, then one alltoallv
+    "histogram": {
+        "comm": {"L": lambda n, p: p + lg(n) * lg(p), "G": lambda n, p: 4.0 * (n / p) + 8.0 * p * lg(n)},
+        "comp": {"c_sort": lambda n, p: 2 * (n / p) * lg(n / p),
+                 "c_partition": lambda n, p: (n / p) * lg(p) * lg(n) / max(lg(n / p), 1.0)},
+    },
+    # Per digit: gather to the root, counting sort there, scatter back
+    "radix": {
+        "comm": {"L": lambda n, p: radix_digits(n) * 2 * lg(p), "G": lambda n, p: radix_digits(n) * 8.0 * n},
+        "comp": {"c_partition": lambda n, p: radix_digits(n) * (n / p), "c_merge": lambda n, p: radix_digits(n) * n},
+    },
+}
+OTHER_FEATURES = {"o": lambda n, p: 1.0, "o_log": lambda n, p: lg(p)}
+
+
+def phase_features(algorithm, phase):
+    if phase == "other":
+        return OTHER_FEATURES
+    if phase == "total":
+        feats = {}
+        for ph in ("comm", "comp"):
+            feats.update(FEATURES[algorithm][ph])
+        feats.update(OTHER_FEATURES)
+        return feats
+    return FEATURES[algorithm][phase]
+
+# ---------------------------------------------------------------------------
+# Fitting: non-negative least squares on relative error, by trying every
+# subset of terms (there are at most a handful)
+
+def solve(a, b):
+    k = len(b)
+    m = [row[:] + [b[i]] for i, row in enumerate(a)]
+    for col in range(k):
+        pivot = max(range(col, k), key=lambda r: abs(m[r][col]))
+        if abs(m[pivot][col]) < 1e-300:
+            return None
+        m[col], m[pivot] = m[pivot], m[col]
+        for r in range(k):
+            if r != col:
+                f = m[r][col] / m[col][col]
+                for c in range(col, k + 1):
+                    m[r][c] -= f * m[col][c]
+    return [m[i][k] / m[i][i] for i in range(k)]
+
+
+def fit_terms(rows, targets, names):
+    # Scale each row by 1/target so the residual is the relative error, and
+    # each column to unit size so the normal equations stay well conditioned
+    weighted = [[x / max(t, 1e-9) for x in row] for row, t in zip(rows, targets)]
+    ones = [1.0] * len(targets)
+    scale = [max(max(abs(r[j]) for r in weighted), 1e-300) for j in range(len(names))]
+    cols = [[r[j] / scale[j] for r in weighted] for j in range(len(names))]
+
+    best, best_err = None, float("inf")
+    for size in range(1, len(names) + 1):
+        for subset in itertools.combinations(range(len(names)), size):
+            ata = [[sum(x * y for x, y in zip(cols[i], cols[j])) for j in subset] for i in subset]
+            atb = [sum(x * y for x, y in zip(cols[i], ones)) for i in subset]
+            coef = solve(ata, atb)
+            if coef is None or any(c < 0 for c in coef):
+                continue
+            err = sum((sum(coef[k] * cols[j][r] for k, j in enumerate(subset)) - 1.0) ** 2
+                      for r in range(len(targets)))
+            if err < best_err:
+                best_err = err
+                best = {names[j]: coef[k] / scale[j] for k, j in enumerate(subset)}
+    params = {name: 0.0 for name in names}
+    if best:
+        params.update(best)
+    return params
+
+
+def fit_phase(runs, algorithm, phase):
+    feats = phase_features(algorithm, phase)
+    names = sorted(feats)
+    usable = [r for r in runs if phase in r and r[phase] > 0]
+    if len(usable) < len(names):
+        return None
+    rows = [[feats[name](r["n"], r["p"]) for name in names] for r in usable]
+    return fit_terms(rows, [r[phase] for r in usable], names)
+
+
+# Groups with fewer runs fall back on the algorithm-wide fit
+MIN_GROUP_RUNS = 8
+
+
+def fit_group(runs, algorithm):
+    split = [r for r in runs if "comm" in r]
+    model = {"runs": len(runs)}
+    if len(split) >= len(runs) / 2 and len(split) >= MIN_GROUP_RUNS // 2:
+        for phase in ("comm", "comp", "other"):
+            params = fit_phase(split, algorithm, phase)
+            if params is not None:
+                model[phase] = params
+    if not all(ph in model for ph in ("comm", "comp", "other")):
+        for phase in ("comm", "comp", "other"):
+            model.pop(phase, None)
+        model["total"] = fit_phase(runs, algorithm, "total")
+        if model["total"] is None:
+            return None
+    return model
+
+
+def fit(runs):
+    model = {}
+    for algorithm in sorted(set(r["algorithm"] for r in runs)):
+        alg_runs = [r for r in runs if r["algorithm"] == algorithm]
+        group_model = fit_group(alg_runs, algorithm)
+        if group_model is None:
+            continue
+        model[f"{algorithm}/*"] = group_model
+        for input_type in sorted(set(r["input_type"] for r in alg_runs)):
+            group = [r for r in alg_runs if r["input_type"] == input_type]
+            if len(group) >= MIN_GROUP_RUNS:
+                group_model = fit_group(group, algorithm)
+                if group_model is not None:
+                    model[f"{algorithm}/{input_type}"] = group_model
+    return model
+
+
+def predict(model, algorithm, n, p, input_type=None):
+    group = model.get(f"{algorithm}/{input_type}") or model.get(f"{algorithm}/*")
+    if group is None:
+        return None
+    parts = {}
+    for phase in ("comm", "comp", "other", "total"):
+        params = group.get(phase)
+        if params:
+            feats = phase_features(algorithm, phase)
+            parts[phase] = sum(params[name] * feats[name](n, p) for name in params)
+    if "total" not in parts:
+        parts["total"] = parts.get("comm", 0) + parts.get("comp", 0) + parts.get("other", 0)
+    return parts
+
+# ---------------------------------------------------------------------------
+# Commands
+
+DEFAULT_PROCS = [2, 4, 8, 16, 32, 64, 128, 256, 512, 1024]
+
+
+def print_model(model):
+    for key, group in model.items():
+        print(f"{key} ({group['runs']} runs)")
+        for phase in ("comm", "comp", "other", "total"):
+            params = group.get(phase)
+            if not params:
+                continue
+            desc = []
+            for name, value in sorted(params.items()):
+                if name == "G" and value > 0:
+                    desc.append(f"G={value:.3e} s/B ({1e-9 / value:.2f} GB/s)")
+                else:
+                    desc.append(f"{name}={value:.3e}")
+            print(f"  {phase:5s} " + ", ".join(desc))
+
+
+def cmd_runs(args):
+    runs = load_runs(args.dirs)
+    for r in sorted(runs, key=lambda r: (r["algorithm"], r["input_type"], r["n"], r["p"])):
+        split = f"comm {r['comm']:.4f} comp {r['comp']:.4f}" if "comm" in r else "no comm/comp regions"
+        print(f"{r['algorithm']:9s} {r['input_type']:9s} n={r['n']:<10d} p={r['p']:<5d} "
+              f"total {r['total']:.4f} s, {split}  {r['file']}")
+    print(f"{len(runs)} runs")
+
+
+def cmd_fit(args):
+    runs = load_runs(args.dirs)
+    if not runs:
+        sys.exit("no runs found")
+    model = fit(runs)
+    print_model(model)
+    with open(args.output, "w") as f:
+        json.dump(model, f, indent=1)
+    print(f"model written to {args.output}")
+
+
+def cmd_predict(args):
+    with open(args.model) as f:
+        model = json.load(f)
+    algorithm = normalize_algorithm(args.algorithm)
+    input_type = normalize_input_type(args.input_type) if args.input_type else None
+    n = 2 ** int(args.n[2:]) if args.n.startswith("2^") else int(args.n)
+    procs = [int(x) for x in args.procs.split(",")] if args.procs else DEFAULT_PROCS
+    best = None
+    print(f"{algorithm}, n={n}, input {input_type or 'any'}")
+    print(f"{'p':>6s} {'total (s)':>12s} {'comm':>10s} {'comp':>10s} {'other':>10s}")
+    for p in procs:
+        parts = predict(model, algorithm, n, p, input_type)
+        if parts is None:
+            sys.exit(f"no model for {algorithm}")
+        print(f"{p:6d} {parts['total']:12.4f} " + " ".join(
+            f"{parts[ph]:10.4f}" if ph in parts else f"{'-':>10s}" for ph in ("comm", "comp", "other")))
+        if best is None or parts["total"] < best[1]:
+            best = (p, parts["total"])
+    print(f"best rank count: {best[0]} ({best[1]:.4f} s predicted)")
+
+
+def cmd_validate(args):
+    runs = load_runs(args.dirs)
+    train, test = [], []
+    if args.holdout == "random":
+        rng = random.Random(args.seed)
+        for r in runs:
+            (test if rng.random() < args.fraction else train).append(r)
+    else:
+        # Hold out the largest n (or p) of every algorithm/input group: the
+        # configurations a model would be asked to extrapolate to
+        key = "n" if args.holdout == "largest-n" else "p"
+        largest = {}
+        for r in runs:
+            g = (r["algorithm"], r["input_type"])
+            largest[g] = max(largest.get(g, 0), r[key])
+        for r in runs:
+            (test if r[key] == largest[(r["algorithm"], r["input_type"])] else train).append(r)
+
+    model = fit(train)
+    print(f"trained on {len(train)} runs, testing on {len(test)} held-out runs ({args.holdout})")
+    print(f"{'algorithm':10s} {'runs':>5s} {'median err':>11s} {'mean err':>9s} {'best p hit':>11s}")
+    for algorithm in sorted(set(r["algorithm"] for r in test)):
+        errors, hits, cases = [], 0, 0
+        alg_test = [r for r in test if r["algorithm"] == algorithm]
+        if f"{algorithm}/*" not in model:
+            print(f"{algorithm:10s} {len(alg_test):5d}  no model (too few training runs)")
+            continue
+        for r in alg_test:
+            parts = predict(model, algorithm, r["n"], r["p"], r["input_type"])
+            errors.append(abs(parts["total"] - r["total"]) / r["total"])
+        # Does the model pick the measured best p among the held-out runs
+        # of one configuration (within 10% of its time)?
+        configs = {}
+        for r in alg_test:
+            configs.setdefault((r["input_type"], r["n"]), []).append(r)
+        for (input_type, n), group in configs.items():
+            if len(group) < 2:
+                continue
+            cases += 1
+            fastest = min(r["total"] for r in group)
+            chosen = min(group, key=lambda r: predict(model, algorithm, n, r["p"], input_type)["total"])
+            hits += chosen["total"] <= 1.1 * fastest
+        errors.sort()
+        hit = f"{hits}/{cases}" if cases else "-"
+        print(f"{algorithm:10s} {len(errors):5d} {100 * errors[len(errors) // 2]:10.1f}% "
+              f"{100 * sum(errors) / len(errors):8.1f}% {hit:>11s}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="LogGP-style performance model for the MPI sorters")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p_runs = sub.add_parser("runs", help="list the runs found in .cali files")
+    p_runs.add_argument("dirs", nargs="+")
+    p_runs.set_defaults(func=cmd_runs)
+
+    p_fit = sub.add_parser("fit", help="fit the model and write it as JSON")
+    p_fit.add_argument("dirs", nargs="+")
+    p_fit.add_argument("-o", "--output", default="model.json")
+    p_fit.set_defaults(func=cmd_fit)
+
+    p_predict = sub.add_parser("predict", help="predict runtime over rank counts")
+    p_predict.add_argument("model")
+    p_predict.add_argument("algorithm")
+    p_predict.add_argument("n", help="element count, e.g. 268435456 or 2^28")
+    p_predict.add_argument("input_type", nargs="?")
+    p_predict.add_argument("--procs", help="comma-separated rank counts")
+    p_predict.set_defaults(func=cmd_predict)
+
+    p_validate = sub.add_parser("validate", help="fit on part of the runs and check the rest")
+    p_validate.add_argument("dirs", nargs="+")
+    p_validate.add_argument("--holdout", choices=["largest-n", "largest-p", "random"], default="largest-n")
+    p_validate.add_argument("--fraction", type=float, default=0.2, help="held-out share for --holdout random")
+    p_validate.add_argument("--seed", type=int, default=1)
+    p_validate.set_defaults(func=cmd_validate)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
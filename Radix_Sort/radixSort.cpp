@@ -14,11 +14,14 @@
 #include <caliper/cali-manager.h>
 #include <adiak.hpp>
 #include <string>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "buffer_arena.h"
 
 // Get the maximum value in the array for counting sort
-int get_max(int *data, int n) {
+int get_max(int *data, long long n) {
     int max_val = data[0];
-    for (int i = 1; i < n; i++) {
+    for (long long i = 1; i < n; i++) {
         if (data[i] > max_val) {
             max_val = data[i];
         }
@@ -26,12 +29,14 @@ int get_max(int *data, int n) {
     return max_val;
 }
 
-// Counting sort for Radix Sort
-void counting_sort(int *data, int n, int exp) {
-    int *output = (int *)malloc(n * sizeof(int));
-    int count[10] = {0};
+// Counting sort for Radix Sort. Stable (filled back to front), so LSD radix
+// sort needs no stable mode: equal keys keep their input order, and the
+// gather/scatter below keeps blocks in rank order.
+void counting_sort(int *data, long long n, long long exp) {
+    int *output = (int *)arena_acquire(n * sizeof(int));
+    long long count[10] = {0};
 
-    for (int i = 0; i < n; i++) {
+    for (long long i = 0; i < n; i++) {
         count[(data[i] / exp) % 10]++;
     }
 
@@ -39,69 +44,74 @@ void counting_sort(int *data, int n, int exp) {
         count[i] += count[i - 1];
     }
 
-    for (int i = n - 1; i >= 0; i--) {
+    for (long long i = n - 1; i >= 0; i--) {
         output[count[(data[i] / exp) % 10] - 1] = data[i];
         count[(data[i] / exp) % 10]--;
     }
 
-    for (int i = 0; i < n; i++) {
+    for (long long i = 0; i < n; i++) {
         data[i] = output[i];
     }
 
-    free(output);
+    arena_release(output);
 }
 
 // Local Radix Sort function
-void radix_sort_local(int *data, int n) {
+void radix_sort_local(int *data, long long n) {
     int max_val = get_max(data, n);
 
-    for (int exp = 1; max_val / exp > 0; exp *= 10) {
+    for (long long exp = 1; max_val / exp > 0; exp *= 10) {
         counting_sort(data, n, exp);
     }
 }
 
 // MPI Radix Sort function
-void mpi_radix_sort(int *local_data, int local_n, int rank, int size) {
+void mpi_radix_sort(int *local_data, long long local_n, int rank, int size) {
     int global_max;
 
     // Compute the local maximum
     int local_max = get_max(local_data, local_n);
 
     // Compute the global maximum
-    MPI_Allreduce(&local_max, &global_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    comm_trace_phase("global_max");
+    trace_Allreduce(&local_max, &global_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
 
     // Perform radix sort on each digit
-    for (int exp = 1; global_max / exp > 0; exp *= 10) {
+    for (long long exp = 1; global_max / exp > 0; exp *= 10) {
+        char phase_name[32];
+        snprintf(phase_name, sizeof(phase_name), "digit_%lld", exp);
+        comm_trace_phase(phase_name);
+
         // Perform local counting sort for the current digit
         counting_sort(local_data, local_n, exp);
 
         // Gather all sorted subarrays at the root process
         int *gathered_data = NULL;
         if (rank == 0) {
-            gathered_data = (int *)malloc(local_n * size * sizeof(int));
+            gathered_data = (int *)arena_acquire(local_n * size * sizeof(int));
         }
 
-        MPI_Gather(local_data, local_n, MPI_INT, gathered_data, local_n, MPI_INT, 0, MPI_COMM_WORLD);
+        large_Gather(local_data, local_n, MPI_INT, gathered_data, 0, MPI_COMM_WORLD);
 
         // Scatter the data back to all processes after sorting at root
         if (rank == 0) {
             counting_sort(gathered_data, local_n * size, exp);
         }
 
-        MPI_Scatter(gathered_data, local_n, MPI_INT, local_data, local_n, MPI_INT, 0, MPI_COMM_WORLD);
+        large_Scatter(gathered_data, local_n, MPI_INT, local_data, 0, MPI_COMM_WORLD);
 
         if (rank == 0) {
-            free(gathered_data);
+            arena_release(gathered_data);
         }
     }
 }
 
 int main(int argc, char *argv[]) {
     int rank, size;
-    int n = 1024; // Default input size
+    long long n = 1024; // Default input size
     int *data = NULL;
     int *local_data = NULL;
-    int local_n;
+    long long local_n;
     double start_time, end_time;
 
     // Initialize MPI
@@ -112,6 +122,12 @@ int main(int argc, char *argv[]) {
     mgr.add("runtime-report");
     mgr.start();
 
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
     // Start main region
     CALI_MARK_BEGIN("main");
 
@@ -120,7 +136,7 @@ int main(int argc, char *argv[]) {
 
     // Get command line arguments
     if (argc >= 2) {
-        n = atoi(argv[1]);
+        n = atoll(argv[1]);
     }
 
     std::string input_type = "random";
@@ -149,20 +165,20 @@ int main(int argc, char *argv[]) {
         // Initialize data based on input_type
         if (input_type == "random") {
             srand(time(NULL));
-            for (int i = 0; i < n; i++) {
+            for (long long i = 0; i < n; i++) {
                 data[i] = rand() % n;
             }
         } else if (input_type == "sorted") {
-            for (int i = 0; i < n; i++) {
+            for (long long i = 0; i < n; i++) {
                 data[i] = i;
             }
         } else if (input_type == "reverse") {
-            for (int i = 0; i < n; i++) {
+            for (long long i = 0; i < n; i++) {
                 data[i] = n - i;
             }
         } else {
             srand(time(NULL));
-            for (int i = 0; i < n; i++) {
+            for (long long i = 0; i < n; i++) {
                 data[i] = rand() % n;
             }
         }
@@ -171,9 +187,10 @@ int main(int argc, char *argv[]) {
     }
 
     // Distribute data to all processes
+    comm_trace_phase("scatter");
     CALI_MARK_BEGIN("comm");
     CALI_MARK_BEGIN("comm_large");
-    MPI_Scatter(data, local_n, MPI_INT, local_data, local_n, MPI_INT, 0, MPI_COMM_WORLD);
+    large_Scatter(data, local_n, MPI_INT, local_data, 0, MPI_COMM_WORLD);
     CALI_MARK_END("comm_large");
     CALI_MARK_END("comm");
 
@@ -189,12 +206,13 @@ int main(int argc, char *argv[]) {
     end_time = MPI_Wtime();
 
     // Gather sorted data
+    comm_trace_phase("gather");
     CALI_MARK_BEGIN("comm");
     CALI_MARK_BEGIN("comm_large");
     if (rank == 0) {
-        MPI_Gather(MPI_IN_PLACE, local_n, MPI_INT, data, local_n, MPI_INT, 0, MPI_COMM_WORLD);
+        large_Gather(MPI_IN_PLACE, local_n, MPI_INT, data, 0, MPI_COMM_WORLD);
     } else {
-        MPI_Gather(local_data, local_n, MPI_INT, data, local_n, MPI_INT, 0, MPI_COMM_WORLD);
+        large_Gather(local_data, local_n, MPI_INT, data, 0, MPI_COMM_WORLD);
     }
     CALI_MARK_END("comm_large");
     CALI_MARK_END("comm");
@@ -206,6 +224,9 @@ int main(int argc, char *argv[]) {
 
     free(local_data);
 
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+
     // Flush and stop Caliper
     mgr.flush();
     mgr.stop();
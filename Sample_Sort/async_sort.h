@@ -0,0 +1,298 @@
+/******************************************************************************
+ * FILE: async_sort.h
+ * DESCRIPTION:
+ *   Non-blocking Sample Sort. isort sorts the local keys, posts the sample
+ *   MPI_Iallgather and returns; the caller keeps the handle and goes on with
+ *   its own work, calling isort_test now and then and isort_wait when it
+ *   needs the result.
+ *
+ *   The sort is a small state machine over the same steps as
+ *   SampleSortLocal:
+ *     ISORT_SPLITTERS  Iallgather of the samples
+ *     ISORT_COUNTS     Ialltoall of the bucket counts
+ *     ISORT_AGREE      Iallreduce deciding between Ialltoallv and the
+ *                      large-count Isend/Irecv path, as large_Alltoallv does
+ *     ISORT_EXCHANGE   Ialltoallv (or Isend/Irecv) of the buckets
+ *   Whenever a test or wait finds the pending operation complete, the
+ *   compute between two exchanges runs right there and the next operation
+ *   is posted, so progress is made only inside isort_test/isort_wait calls
+ *   (and inside whatever MPI calls the application makes); there is no
+ *   helper thread, which would need MPI_THREAD_MULTIPLE.
+ *
+ *   The handle records how long the caller was blocked in isort_wait and how
+ *   much compute ran inside test/wait calls; compared with the time of a
+ *   blocking sort this shows how much of the exchange was hidden.
+ *
+ *   isort and every isort_test / isort_wait call that posts the next
+ *   operation switch the comm_trace (and arena) phase to isort_splitters,
+ *   isort_counts or isort_exchange and leave it there. Callers that trace
+ *   their own communication between those calls must set their phase again
+ *   after each one, or it is charged to the sort.
+ *
+ *   The keys passed to isort are sorted in place and used as the send buffer,
+ *   so neither they nor the handle may be touched or moved until the sort
+ *   completes. Buckets always travel uncompressed (SORT_COMPRESS is ignored).
+ ******************************************************************************/
+
+#ifndef ASYNC_SORT_H
+#define ASYNC_SORT_H
+
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+#include <caliper/cali.h>
+#include <climits>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "stable_sort.h"
+#include "buffer_arena.h"
+#include "sample_sort.h"
+
+enum ISortState {
+    ISORT_SPLITTERS,
+    ISORT_COUNTS,
+    ISORT_AGREE,
+    ISORT_EXCHANGE,
+    ISORT_DONE
+};
+
+struct ISortHandle {
+    MPI_Comm comm;
+    ISortState state;
+    int* elmnts;
+    long long nlocal;
+    long long nsorted;
+    SampleSortBuffers buf;
+    std::vector<MPI_Request> reqs;
+    std::vector<MPI_Datatype> types;   // large-count block types of the pending exchange
+    std::vector<int> sc, sd, rc, rd;   // int counts for Ialltoallv, alive until it completes
+    int local_small, small;
+    int trace_phase;                   // comm_trace phase of the pending operation
+    double start_time;                 // isort called
+    double done_time;                  // completion observed
+    double progress_time;              // compute run inside isort_test / isort_wait
+    double wait_time;                  // blocked inside isort_wait
+    int tests;
+};
+
+// Charges the traced phase of the pending operation with time spent blocked
+inline void isort_trace_time(ISortHandle& h, double t) {
+    CommTrace& t_state = comm_trace_state();
+    if (t_state.enabled && h.trace_phase >= 0)
+        t_state.phases[h.trace_phase].time += t;
+}
+
+// Switches the global comm_trace phase (see the header) and keeps its index
+// so isort_wait can charge blocked time to it
+inline void isort_set_phase(ISortHandle& h, const char* name) {
+    comm_trace_phase(name);
+    h.trace_phase = comm_trace_state().current;
+}
+
+// Runs the step after the pending operation and posts the next one
+inline void isort_advance(ISortHandle& h) {
+    int npes, myrank;
+    MPI_Comm_size(h.comm, &npes);
+    MPI_Comm_rank(h.comm, &myrank);
+    SampleSortBuffers& buf = h.buf;
+    double t0 = MPI_Wtime();
+    h.reqs.clear();
+
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    if (h.state == ISORT_SPLITTERS) {
+        // Splitters and bucket counts, as in SampleSortLocal
+        int* splitters = buf.splitters.data();
+        int* allpicks = buf.allpicks.data();
+        std::sort(allpicks, allpicks + (long long)npes * (npes - 1));
+        for (int i = 1; i < npes; i++)
+            splitters[i - 1] = allpicks[i * (npes - 1)];
+        splitters[npes - 1] = INT_MAX;
+
+        buf.scounts.assign(npes, 0);
+        for (long long i = 0, j = 0; i < h.nlocal; i++) {
+            while (j < npes - 1 && h.elmnts[i] >= splitters[j])
+                j++;
+            buf.scounts[j]++;
+        }
+        buf.sdispls.assign(npes, 0);
+        for (int i = 1; i < npes; i++)
+            buf.sdispls[i] = buf.sdispls[i - 1] + buf.scounts[i - 1];
+        buf.rcounts.resize(npes);
+    } else if (h.state == ISORT_COUNTS) {
+        buf.rdispls.assign(npes, 0);
+        for (int i = 1; i < npes; i++)
+            buf.rdispls[i] = buf.rdispls[i - 1] + buf.rcounts[i - 1];
+        h.nsorted = buf.rdispls[npes - 1] + buf.rcounts[npes - 1];
+        buf.sorted.resize(h.nsorted);
+
+        // Every rank has to take the same exchange path
+        h.local_small = 1;
+        for (int i = 0; i < npes && h.local_small; i++)
+            h.local_small = fits_int(buf.sdispls[i] + buf.scounts[i]) && fits_int(buf.rdispls[i] + buf.rcounts[i]);
+    } else if (h.state == ISORT_AGREE && h.small) {
+        h.sc.resize(npes);
+        h.sd.resize(npes);
+        h.rc.resize(npes);
+        h.rd.resize(npes);
+        for (int i = 0; i < npes; i++) {
+            h.sc[i] = (int)buf.scounts[i];
+            h.sd[i] = (int)buf.sdispls[i];
+            h.rc[i] = (int)buf.rcounts[i];
+            h.rd[i] = (int)buf.rdispls[i];
+        }
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    // Post the next operation
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    if (h.state == ISORT_SPLITTERS) {
+        isort_set_phase(h, "isort_counts");
+        CommTracePhase* ph = comm_trace_current();
+        for (int i = 0; i < npes && ph != NULL; i++)
+            comm_trace_send(ph, h.comm, i, (long long)sizeof(long long));
+        h.reqs.push_back(MPI_REQUEST_NULL);
+        MPI_Ialltoall(buf.scounts.data(), 1, MPI_LONG_LONG, buf.rcounts.data(), 1, MPI_LONG_LONG, h.comm,
+                      &h.reqs.back());
+        h.state = ISORT_COUNTS;
+    } else if (h.state == ISORT_COUNTS) {
+        h.reqs.push_back(MPI_REQUEST_NULL);
+        MPI_Iallreduce(&h.local_small, &h.small, 1, MPI_INT, MPI_MIN, h.comm, &h.reqs.back());
+        h.state = ISORT_AGREE;
+    } else if (h.state == ISORT_AGREE) {
+        isort_set_phase(h, "isort_exchange");
+        CommTracePhase* ph = comm_trace_current();
+        for (int i = 0; i < npes && ph != NULL; i++) {
+            if (buf.scounts[i] > 0)
+                comm_trace_send(ph, h.comm, i, buf.scounts[i] * (long long)sizeof(int));
+        }
+        if (h.small) {
+            h.reqs.push_back(MPI_REQUEST_NULL);
+            MPI_Ialltoallv(h.elmnts, h.sc.data(), h.sd.data(), MPI_INT, buf.sorted.data(), h.rc.data(), h.rd.data(),
+                           MPI_INT, h.comm, &h.reqs.back());
+        } else {
+            // Point to point, one block type per nonzero count
+            for (int i = 0; i < npes; i++) {
+                if (buf.rcounts[i] == 0)
+                    continue;
+                MPI_Datatype block;
+                large_count_type(buf.rcounts[i], MPI_INT, &block);
+                h.types.push_back(block);
+                h.reqs.push_back(MPI_REQUEST_NULL);
+                MPI_Irecv(buf.sorted.data() + buf.rdispls[i], 1, block, i, 0, h.comm, &h.reqs.back());
+            }
+            for (int i = 0; i < npes; i++) {
+                if (buf.scounts[i] == 0)
+                    continue;
+                MPI_Datatype block;
+                large_count_type(buf.scounts[i], MPI_INT, &block);
+                h.types.push_back(block);
+                h.reqs.push_back(MPI_REQUEST_NULL);
+                MPI_Isend(h.elmnts + buf.sdispls[i], 1, block, i, 0, h.comm, &h.reqs.back());
+            }
+        }
+        h.state = ISORT_EXCHANGE;
+    }
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    if (h.state == ISORT_EXCHANGE && h.reqs.empty()) {
+        // Only reached once the exchange has completed: merge the runs
+        for (size_t i = 0; i < h.types.size(); i++)
+            MPI_Type_free(&h.types[i]);
+        h.types.clear();
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_large");
+        merge_sorted_runs(buf.sorted.data(), buf.rdispls.data(), buf.rcounts.data(), npes, buf.merge_tmp);
+        CALI_MARK_END("comp_large");
+        CALI_MARK_END("comp");
+        h.state = ISORT_DONE;
+        h.done_time = MPI_Wtime();
+    }
+    h.progress_time += MPI_Wtime() - t0;
+}
+
+// Sorts nlocal keys (nlocal may differ between ranks) without blocking on
+// communication. Collective: every rank of comm calls it, then drives the
+// sort with isort_test / isort_wait.
+inline void isort(int* elmnts, long long nlocal, ISortHandle& h, MPI_Comm comm) {
+    int npes;
+    MPI_Comm_size(comm, &npes);
+    h.comm = comm;
+    h.elmnts = elmnts;
+    h.nlocal = nlocal;
+    h.nsorted = 0;
+    h.reqs.clear();
+    h.types.clear();
+    h.start_time = MPI_Wtime();
+    h.done_time = 0;
+    h.progress_time = 0;
+    h.wait_time = 0;
+    h.tests = 0;
+
+    SampleSortBuffers& buf = h.buf;
+    buf.splitters.resize(npes);
+    buf.allpicks.resize((long long)npes * (npes - 1));
+
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_large");
+    std::sort(elmnts, elmnts + nlocal);
+    CALI_MARK_END("comp_large");
+    CALI_MARK_END("comp");
+    for (int i = 1; i < npes; i++)
+        buf.splitters[i - 1] = nlocal > 0 ? elmnts[i * nlocal / npes] : INT_MAX;
+
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    isort_set_phase(h, "isort_splitters");
+    CommTracePhase* ph = comm_trace_current();
+    for (int i = 0; i < npes && ph != NULL; i++)
+        comm_trace_send(ph, comm, i, (long long)(npes - 1) * sizeof(int));
+    h.reqs.push_back(MPI_REQUEST_NULL);
+    MPI_Iallgather(buf.splitters.data(), npes - 1, MPI_INT, buf.allpicks.data(), npes - 1, MPI_INT, comm,
+                   &h.reqs.back());
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    h.state = ISORT_SPLITTERS;
+}
+
+// Makes progress without blocking; true once the sort is done. Every step
+// whose operation has completed runs now, so one call may finish several.
+inline bool isort_test(ISortHandle& h) {
+    h.tests++;
+    while (h.state != ISORT_DONE) {
+        int flag = 0;
+        MPI_Testall((int)h.reqs.size(), h.reqs.data(), &flag, MPI_STATUSES_IGNORE);
+        if (!flag)
+            return false;
+        h.reqs.clear();
+        isort_advance(h);
+    }
+    return true;
+}
+
+// Blocks until the sort is done. The result is h.buf.sorted (the returned
+// pointer), *nsorted keys.
+inline int* isort_wait(ISortHandle& h, long long* nsorted) {
+    while (h.state != ISORT_DONE) {
+        // Only the bucket exchange moves bulk data
+        const char* region = h.state == ISORT_EXCHANGE ? "comm_large" : "comm_small";
+        double t0 = MPI_Wtime();
+        CALI_MARK_BEGIN("comm");
+        CALI_MARK_BEGIN(region);
+        MPI_Waitall((int)h.reqs.size(), h.reqs.data(), MPI_STATUSES_IGNORE);
+        CALI_MARK_END(region);
+        CALI_MARK_END("comm");
+        double t = MPI_Wtime() - t0;
+        h.wait_time += t;
+        isort_trace_time(h, t);
+        h.reqs.clear();
+        isort_advance(h);
+    }
+    *nsorted = h.nsorted;
+    return h.buf.sorted.data();
+}
+
+#endif
@@ -0,0 +1,159 @@
+/******************************************************************************
+ * FILE: incremental_sort.cpp
+ * DESCRIPTION:
+ *   Driver for the incremental sort (incremental_sort.h) with Caliper
+ *   instrumentation. Adds a series of random batches to a distributed sorted
+ *   dataset, checks that the result is globally sorted, and times a full
+ *   SampleSort of the accumulated data for comparison.
+ *
+ *   Later batches drift towards larger keys, so the blocks of the high ranks
+ *   grow and the skew threshold is eventually crossed.
+ *
+ *   Usage: mpirun -np <p> ./incremental_sort <batch size> <batches> [skew threshold]
+ ******************************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+#include <cstdlib>
+#include <caliper/cali.h>
+#include <caliper/cali-manager.h>
+#include <climits>
+#include "comm_trace.h"
+#include "incremental_sort.h"
+
+// Random keys in [0, 10 * batch size]; batch b > 0 draws from the upper
+// part of the range with growing probability
+void fill_batch(int* elmnts, long long nlocal, long long batch_size, int b) {
+    long long range = 10 * batch_size + 1;
+    for (long long i = 0; i < nlocal; i++) {
+        long long key = rand() % range;
+        if (b > 0 && rand() % 8 < std::min(b, 6))
+            key = range / 2 + key / 2;
+        elmnts[i] = (int)key;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    CALI_CXX_MARK_FUNCTION;
+    int npes, myrank;
+    long long batch_size, nlocal;
+    int nbatches;
+    double skew_threshold = INCREMENTAL_SKEW_THRESHOLD;
+    double stime, etime;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &npes);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+
+    cali::ConfigManager mgr;
+    mgr.start();
+
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
+    if (argc < 3) {
+        if (myrank == 0) {
+            std::cout << "Usage: mpiexec -n <p> " << argv[0] << " <batch size> <batches> [skew threshold]"
+                      << std::endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    batch_size = atoll(argv[1]);
+    nbatches = atoi(argv[2]);
+    if (argc >= 4)
+        skew_threshold = atof(argv[3]);
+    nlocal = batch_size / npes;
+
+    // Every batch is kept for the full re-sort at the end
+    std::vector<int> all_batches;
+    int* batch = new int[nlocal > 0 ? nlocal : 1];
+    srand(myrank);
+
+    IncrementalDataset ds;
+    double first_time = 0, add_time = 0, max_add_time = 0;
+    for (int b = 0; b < nbatches; b++) {
+        CALI_MARK_BEGIN("data_init_runtime");
+        fill_batch(batch, nlocal, batch_size, b);
+        all_batches.insert(all_batches.end(), batch, batch + nlocal);
+        CALI_MARK_END("data_init_runtime");
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        stime = MPI_Wtime();
+        if (b == 0) {
+            CALI_MARK_BEGIN("incremental_init");
+            incremental_init(ds, batch, nlocal, MPI_COMM_WORLD, skew_threshold);
+            CALI_MARK_END("incremental_init");
+        } else {
+            CALI_MARK_BEGIN("incremental_add");
+            incremental_add(ds, batch, nlocal);
+            CALI_MARK_END("incremental_add");
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        etime = MPI_Wtime();
+        if (b == 0) {
+            first_time = etime - stime;
+        } else {
+            add_time += etime - stime;
+            max_add_time = std::max(max_add_time, etime - stime);
+        }
+    }
+
+    CALI_MARK_BEGIN("correctness_check");
+    // Local order plus order across each rank boundary
+    arena_vector<int>& data = incremental_compact(ds);
+    long long nsorted = (long long)data.size();
+    int local_ok = std::is_sorted(data.begin(), data.end()) ? 1 : 0;
+    int last = nsorted > 0 ? data[nsorted - 1] : INT_MIN;
+    int prev_max = INT_MIN;
+    MPI_Exscan(&last, &prev_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (myrank > 0 && nsorted > 0 && prev_max > data[0])
+        local_ok = 0;
+    int all_ok;
+    MPI_Reduce(&local_ok, &all_ok, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+    CALI_MARK_END("correctness_check");
+
+    // Full re-sort of everything seen, for comparison
+    long long nall = (long long)all_batches.size(), nresorted;
+    SampleSortBuffers buf;
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    SampleSortLocal(nall, all_batches.data(), &nresorted, buf, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    etime = MPI_Wtime();
+    double resort_time = etime - stime;
+
+    if (myrank == 0) {
+        std::cout << "Total sorted elements: " << ds.n << std::endl;
+        std::cout << "Expected sorted elements: " << nlocal * npes * nbatches << std::endl;
+        std::cout << "Is the sorted array valid? " << (all_ok ? "Yes" : "No") << std::endl;
+        std::cout << "Batches: " << ds.batches << ", rebalances: " << ds.rebalances << " (threshold "
+                  << skew_threshold << "), final skew " << ds.skew << std::endl;
+        std::cout << "Batch elements routed to other ranks: " << ds.routed << ", moved by rebalances: "
+                  << ds.rebalance_moved << std::endl;
+        std::cout << "First batch time: " << first_time << " sec" << std::endl;
+        if (nbatches > 1)
+            std::cout << "Incremental batch time: " << add_time / (nbatches - 1) << " sec average, "
+                      << max_add_time << " sec max" << std::endl;
+        std::cout << "Full re-sort time: " << resort_time << " sec" << std::endl;
+    }
+
+    delete[] batch;
+    incremental_free(ds);
+
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+    run_codec_finalize(MPI_COMM_WORLD);
+
+    mgr.stop();
+    mgr.flush();
+
+    MPI_Finalize();
+
+    return 0;
+}
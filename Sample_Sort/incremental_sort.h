@@ -0,0 +1,250 @@
+/******************************************************************************
+ * FILE: incremental_sort.h
+ * DESCRIPTION:
+ *   Keeps a distributed dataset sorted while new batches arrive, without
+ *   re-sorting what is already in place.
+ *
+ *   The first batch is sorted with SampleSortLocal and its splitters are
+ *   kept. Every later batch is sorted locally, cut at the same splitters and
+ *   exchanged with one Alltoallv, so only the batch travels.
+ *
+ *   Each rank keeps its keys as a few sorted runs, each more than twice the
+ *   size of the next (log-structured). The received batch becomes the
+ *   newest run, and while the newest run is at least half the size of the
+ *   one before it the two are merged backwards in place, so runs of similar
+ *   size merge. Every key is merged O(log(n / batch)) times, so a batch
+ *   costs O(batch log) amortized instead of a pass over the whole block.
+ *   incremental_compact merges everything into one block for readers, and
+ *   incremental_free releases the dataset (call it before MPI_Finalize).
+ *
+ *   Batches that are not distributed like the first one make some blocks
+ *   grow faster than others. Once the largest block exceeds skew_threshold
+ *   times the mean, the dataset is moved into exact ceil(n/p) blocks with
+ *   rebalance_blocks and the splitters are reset to the new block
+ *   boundaries; that moves only the surplus, not the whole dataset.
+ ******************************************************************************/
+
+#ifndef INCREMENTAL_SORT_H
+#define INCREMENTAL_SORT_H
+
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <mpi.h>
+#include <caliper/cali.h>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "stable_sort.h"
+#include "buffer_arena.h"
+#include "run_codec.h"
+#include "rebalance.h"
+#include "sample_sort.h"
+
+// Largest block over mean block size that triggers a rebalance
+#define INCREMENTAL_SKEW_THRESHOLD 1.25
+
+struct IncrementalDataset {
+    MPI_Comm comm;
+    std::vector<arena_vector<int> > runs;  // resident sorted runs, largest (oldest) first
+    std::vector<int> splitters;   // rank r holds splitters[r-1] <= key < splitters[r]
+    long long n;                  // elements on all ranks
+    double skew_threshold;
+    int batches;
+    int rebalances;
+    long long routed;             // batch elements that changed rank, all batches
+    long long rebalance_moved;    // elements moved by rebalances
+    double skew;                  // largest block over mean after the last batch
+    MPI_Datatype stats_type;      // {routed, size, size} reduction, created on first add
+    MPI_Op stats_op;
+};
+
+// Collective. Sorts the first batch (which is modified) with SampleSortLocal
+// and keeps its splitters.
+inline void incremental_init(IncrementalDataset& ds, int* batch, long long nbatch, MPI_Comm comm,
+                             double skew_threshold = INCREMENTAL_SKEW_THRESHOLD) {
+    SampleSortBuffers buf;
+    long long nsorted;
+    SampleSortLocal(nbatch, batch, &nsorted, buf, comm);
+
+    ds.comm = comm;
+    ds.runs.assign(1, arena_vector<int>());
+    ds.runs[0].swap(buf.sorted);
+    ds.splitters.assign(buf.splitters.begin(), buf.splitters.end());
+    ds.skew_threshold = skew_threshold;
+    ds.batches = 1;
+    ds.rebalances = 0;
+    ds.routed = 0;
+    ds.rebalance_moved = 0;
+    MPI_Allreduce(&nsorted, &ds.n, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    ds.skew = 1.0;
+    ds.stats_type = MPI_DATATYPE_NULL;
+    ds.stats_op = MPI_OP_NULL;
+}
+
+// Merges run b (the newer one) into a: a grows by b's length and is filled
+// from the back, so there is no separate output buffer to allocate and zero.
+// Equal keys keep a's copies first.
+inline void incremental_merge_into(arena_vector<int>& a, const arena_vector<int>& b) {
+    long long i = (long long)a.size() - 1, j = (long long)b.size() - 1;
+    a.resize(a.size() + b.size());
+    for (long long k = (long long)a.size() - 1; j >= 0; k--)
+        a[k] = i >= 0 && a[i] > b[j] ? a[i--] : b[j--];
+}
+
+// Merges the newest runs while the last is at least half the one before it
+inline void incremental_settle(IncrementalDataset& ds) {
+    while (ds.runs.size() >= 2 && ds.runs[ds.runs.size() - 2].size() <= 2 * ds.runs.back().size()) {
+        incremental_merge_into(ds.runs[ds.runs.size() - 2], ds.runs.back());
+        ds.runs.pop_back();
+    }
+}
+
+inline long long incremental_local_size(const IncrementalDataset& ds) {
+    long long size = 0;
+    for (size_t r = 0; r < ds.runs.size(); r++)
+        size += (long long)ds.runs[r].size();
+    return size;
+}
+
+// Merges all runs into one and returns this rank's sorted block
+inline arena_vector<int>& incremental_compact(IncrementalDataset& ds) {
+    if (ds.runs.empty())
+        ds.runs.push_back(arena_vector<int>());
+    while (ds.runs.size() >= 2) {
+        incremental_merge_into(ds.runs[ds.runs.size() - 2], ds.runs.back());
+        ds.runs.pop_back();
+    }
+    return ds.runs[0];
+}
+
+// Element-wise over {routed, size, size} triples: sum, sum, max
+inline void incremental_stats_op(void* in, void* inout, int* len, MPI_Datatype*) {
+    const long long* a = (const long long*)in;
+    long long* b = (long long*)inout;
+    for (int i = 0; i < *len; i++, a += 3, b += 3) {
+        b[0] += a[0];
+        b[1] += a[1];
+        b[2] = std::max(b[2], a[2]);
+    }
+}
+
+// Splitters matching the current blocks: each rank starts at the first key
+// of the next non-empty rank, so new keys land next to their neighbours
+inline void incremental_reset_splitters(IncrementalDataset& ds) {
+    int npes;
+    MPI_Comm_size(ds.comm, &npes);
+    int first = INT_MAX;
+    for (size_t r = 0; r < ds.runs.size(); r++)
+        if (!ds.runs[r].empty())
+            first = std::min(first, ds.runs[r][0]);
+    std::vector<int> firsts(npes);
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Allgather(&first, 1, MPI_INT, firsts.data(), 1, MPI_INT, ds.comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    ds.splitters.assign(npes, INT_MAX);
+    for (int r = npes - 2; r >= 0; r--)
+        ds.splitters[r] = std::min(firsts[r + 1], ds.splitters[r + 1]);
+}
+
+// Collective. Sorts batch (which is modified) into the dataset; ranks may
+// pass different batch sizes, including none.
+inline void incremental_add(IncrementalDataset& ds, int* batch, long long nbatch) {
+    int npes, myrank;
+    MPI_Comm_size(ds.comm, &npes);
+    MPI_Comm_rank(ds.comm, &myrank);
+
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    std::sort(batch, batch + nbatch);
+    // Cut the sorted batch at the kept splitters
+    arena_vector<long long> scounts(npes), sdispls(npes), rcounts(npes), rdispls(npes, 0);
+    long long prev = 0;
+    for (int r = 0; r < npes; r++) {
+        long long end = r == npes - 1 ? nbatch : std::lower_bound(batch + prev, batch + nbatch, ds.splitters[r]) - batch;
+        sdispls[r] = prev;
+        scounts[r] = end - prev;
+        prev = end;
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    comm_trace_phase("batch_counts");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    int path = large_count_exchange(scounts.data(), sdispls.data(), rcounts.data(), ds.comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    for (int r = 1; r < npes; r++)
+        rdispls[r] = rdispls[r - 1] + rcounts[r - 1];
+    long long nrecv = rdispls[npes - 1] + rcounts[npes - 1];
+    arena_vector<int> received(nrecv);
+
+    comm_trace_phase("batch_exchange");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_large");
+    if (run_codec_enabled())
+        compressed_Alltoallv(batch, scounts.data(), sdispls.data(), received.data(), rcounts.data(), rdispls.data(),
+                             ds.comm);
+    else
+        large_Alltoallv(batch, scounts.data(), sdispls.data(), received.data(), rcounts.data(), rdispls.data(),
+                        MPI_INT, ds.comm, path);
+    CALI_MARK_END("comm_large");
+    CALI_MARK_END("comm");
+
+    // Received runs into one, which joins the resident runs as the newest
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_large");
+    if (nrecv > 0) {
+        arena_vector<int> tmp;
+        merge_sorted_runs(received.data(), rdispls.data(), rcounts.data(), npes, tmp);
+        ds.runs.push_back(arena_vector<int>());
+        ds.runs.back().swap(received);
+        incremental_settle(ds);
+    }
+    CALI_MARK_END("comp_large");
+    CALI_MARK_END("comp");
+
+    // Routed and resident totals plus the largest block, in one reduction
+    if (ds.stats_op == MPI_OP_NULL) {
+        MPI_Type_contiguous(3, MPI_LONG_LONG, &ds.stats_type);
+        MPI_Type_commit(&ds.stats_type);
+        MPI_Op_create(incremental_stats_op, 1, &ds.stats_op);
+    }
+    long long local_size = incremental_local_size(ds);
+    long long local[3] = {nbatch - scounts[myrank], local_size, local_size}, global[3];
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Allreduce(local, global, 1, ds.stats_type, ds.stats_op, ds.comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    ds.routed += global[0];
+    ds.n = global[1];
+    ds.batches++;
+    ds.skew = ds.n > 0 ? (double)global[2] * npes / ds.n : 1.0;
+
+    if (ds.skew > ds.skew_threshold) {
+        arena_vector<int>& data = incremental_compact(ds);
+        arena_vector<int> blocks;
+        RebalanceStats stats;
+        rebalance_blocks(data.data(), (long long)data.size(), blocks, MPI_INT, ds.comm, &stats);
+        data.swap(blocks);
+        incremental_reset_splitters(ds);
+        ds.rebalances++;
+        ds.rebalance_moved += stats.moved;
+        ds.skew = ds.n > 0 ? (double)stats.block * npes / ds.n : 1.0;
+    }
+}
+
+// Releases the runs and the stats reduction; the dataset needs
+// incremental_init again before the next use
+inline void incremental_free(IncrementalDataset& ds) {
+    std::vector<arena_vector<int> >().swap(ds.runs);
+    if (ds.stats_op != MPI_OP_NULL) {
+        MPI_Op_free(&ds.stats_op);
+        MPI_Type_free(&ds.stats_type);
+    }
+}
+
+#endif
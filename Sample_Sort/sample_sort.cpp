@@ -14,133 +14,20 @@
 #include <caliper/cali.h>
 #include <caliper/cali-manager.h>
 #include <climits>
-
-int* SampleSort(int n, int* elmnts, int* nsorted, MPI_Comm comm) {
-    int i, j, nlocal, npes, myrank;
-    int* sorted_elmnts;
-    int* splitters = nullptr;
-    int* allpicks = nullptr;
-    int* scounts = nullptr;
-    int* sdispls = nullptr;
-    int* rcounts = nullptr;
-    int* rdispls = nullptr;
-
-    // Establishing communicator-related information 
-    MPI_Comm_size(comm, &npes);
-    MPI_Comm_rank(comm, &myrank);
-    nlocal = n / npes;
-
-
-
-    // Allocate memory for the arrays that will store the splitters
-    splitters = new int[npes];
-    allpicks = new int[npes * (npes - 1)];
-
-    // Sort local array using std::sort 
-    
-
-    CALI_MARK_BEGIN("comp_small");
-    std::sort(elmnts, elmnts + nlocal);
-    CALI_MARK_END("comp_small");
-
-
-    // Select local npes-1 equally spaced elements 
-    for (i = 1; i < npes; i++)
-        splitters[i - 1] = elmnts[i * nlocal / npes];
-
-    // Gather the samples in the processors 
-    CALI_MARK_BEGIN("comp_large");
-    MPI_Allgather(splitters, npes - 1, MPI_INT, allpicks, npes - 1, MPI_INT, comm);
-    CALI_MARK_END("comp_large");
-
-
-    // Sort the samples using std::sort 
-
-    CALI_MARK_BEGIN("comp_small");
-    std::sort(allpicks, allpicks + npes * (npes - 1));
-    CALI_MARK_END("comp_small");    
-
-    CALI_MARK_BEGIN("comm"); 
-    CALI_MARK_BEGIN("comm_small");
-    // Pick splitters 
-    for (i = 1; i < npes; i++)
-        splitters[i - 1] = allpicks[i * npes];
-    splitters[npes - 1] = INT_MAX;
-    CALI_MARK_END("comm_small");
-    CALI_MARK_END("comm"); 
-
-    // comm large the number of elements that belong to each bucket 
-    CALI_MARK_BEGIN("comm"); 
-    CALI_MARK_BEGIN("comm_large");
-    scounts = new int[npes]();
-    for (j = i = 0; i < nlocal; i++) {
-        while (j < npes - 1 && elmnts[i] >= splitters[j]) {
-            j++;
-        }
-        scounts[j]++;
-    }
-    CALI_MARK_END("comm_large");
-    CALI_MARK_END("comm"); 
-
-
-
-    // Determine the starting location of each bucket's elements in the elmnts array 
-    
-    sdispls = new int[npes]();
-    for (i = 1; i < npes; i++)
-        sdispls[i] = sdispls[i - 1] + scounts[i - 1];
-
-    // Perform an all-to-all to inform the corresponding processes of the number of elements 
-    rcounts = new int[npes];
-    CALI_MARK_BEGIN("comm"); 
-    CALI_MARK_BEGIN("comm_large");
-    MPI_Alltoall(scounts, 1, MPI_INT, rcounts, 1, MPI_INT, comm);
-    CALI_MARK_END("comm_large");
-    CALI_MARK_END("comm"); 
-
-    // Based on rcounts determine where in the local array the data from each processor 
-    // will be stored. This array will store the received elements as well as the final 
-    // sorted sequence
-    rdispls = new int[npes]();
-    for (i = 1; i < npes; i++)
-        rdispls[i] = rdispls[i - 1] + rcounts[i - 1];
-    *nsorted = rdispls[npes - 1] + rcounts[npes - 1];
-    sorted_elmnts = new int[*nsorted];
-
-    // Each process sends and receives the corresponding elements 
-    CALI_MARK_BEGIN("comm"); 
-    MPI_Alltoallv(elmnts, scounts, sdispls, MPI_INT, sorted_elmnts, rcounts, rdispls, MPI_INT, comm);
-    CALI_MARK_END("comm"); 
-
-
-    // Perform the final local sort
-
- 
-    CALI_MARK_BEGIN("comp_small"); 
-    std::sort(sorted_elmnts, sorted_elmnts + (*nsorted));
-    CALI_MARK_END("comp_small");
-
-
-    // Free allocated memory 
-    delete[] splitters;
-    delete[] allpicks;
-    delete[] scounts;
-    delete[] sdispls;
-    delete[] rcounts;
-    delete[] rdispls;
-
-    return sorted_elmnts;
-}
+#include <string>
+#include "comm_trace.h"
+#include "sample_sort.h"
+#include "rebalance.h"
 
 int main(int argc, char* argv[]) {
     CALI_CXX_MARK_FUNCTION;
-    int n;
+    long long n;
     int npes;
     int myrank;
-    int nlocal;
+    long long nlocal;
     int* elmnts;  /* array that stores the local elements */
-    int* vsorted; /* array that stores the final sorted elements */
-    int nsorted;  /* number of elements in vsorted */
+    arena_vector<int> vsorted; /* array that stores the final sorted elements */
+    long long nsorted;  /* number of elements in vsorted */
     double stime, etime;
 
     MPI_Init(&argc, &argv);
@@ -150,15 +37,32 @@ int main(int argc, char* argv[]) {
     cali::ConfigManager mgr;
     mgr.start();
 
-    if (argc != 2) {
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
+    if (argc < 2 || argc > 5) {
         if (myrank == 0) {
-            std::cout << "Usage: mpiexec -n <p> " << argv[0] << " <n>" << std::endl;
+            std::cout << "Usage: mpiexec -n <p> " << argv[0] << " <n> [stable] [rma] [rebalance]" << std::endl;
         }
         //MPI_Finalize();
         return 1;
     }
 
-    n = atoi(argv[1]);
+    n = atoll(argv[1]);
+    bool stable = false;
+    bool rebalance = false;
+    SampleSortExchange exchange = SAMPLE_SORT_ALLTOALLV;
+    for (int a = 2; a < argc; a++) {
+        if (std::string(argv[a]) == "stable")
+            stable = true;
+        else if (std::string(argv[a]) == "rma")
+            exchange = SAMPLE_SORT_RMA;
+        else if (std::string(argv[a]) == "rebalance")
+            rebalance = true;
+    }
     nlocal = n / npes; /* Compute the number of elements to be stored locally. */
 
     /* Allocate memory for the various arrays */
@@ -173,14 +77,14 @@ int main(int argc, char* argv[]) {
     int current_value = rand() % (10 * n + 1);  
 elmnts[0] = current_value;
 
-for (int i = 1; i < nlocal; i++) {
+for (long long i = 1; i < nlocal; i++) {
     current_value += rand() % (10 * n + 1);  
     elmnts[i] = current_value;
 }
     // Sorted End
 
     // Random Start
-    //for (int i = 0; i < nlocal; i++) {
+    //for (long long i = 0; i < nlocal; i++) {
     //    elmnts[i] = rand() % (10 * n + 1);
     //}
     // Random End
@@ -193,7 +97,8 @@ for (int i = 1; i < nlocal; i++) {
 
     // comp start
     
-    vsorted = SampleSort(n, elmnts, &nsorted, MPI_COMM_WORLD);
+    SampleSort(n, elmnts, vsorted, MPI_COMM_WORLD, stable, exchange);
+    nsorted = (long long)vsorted.size();
     CALI_MARK_END("comp");
     //comp end
     etime = MPI_Wtime();
@@ -203,12 +108,27 @@ for (int i = 1; i < nlocal; i++) {
     MPI_Barrier(MPI_COMM_WORLD);
     CALI_MARK_END("MPI_Barrier");
 
+    // Optional: exact ceil(n/p) blocks for stages that need equal counts
+    RebalanceStats rebalance_stats;
+    double rebalance_time = 0;
+    if (rebalance) {
+        arena_vector<int> blocks;
+        double rtime = MPI_Wtime();
+        CALI_MARK_BEGIN("rebalance");
+        rebalance_blocks(vsorted.data(), nsorted, blocks, MPI_INT, MPI_COMM_WORLD, &rebalance_stats);
+        CALI_MARK_END("rebalance");
+        rebalance_time = MPI_Wtime() - rtime;
+        vsorted.swap(blocks);
+        nsorted = (long long)vsorted.size();
+    }
+
     // Gather size of sorted arrays from all processes 
-    int total_sorted_elements = nsorted;
-    int* total_counts = new int[npes];
+    long long total_sorted_elements = nsorted;
+    long long* total_counts = new long long[npes];
     //comm large start
+    comm_trace_phase("gather_counts");
     CALI_MARK_BEGIN("comm-large");
-    MPI_Gather(&nsorted, 1, MPI_INT, total_counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    trace_Gather(&nsorted, 1, MPI_LONG_LONG, total_counts, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
     CALI_MARK_BEGIN("comm-large");
     //comm large end
 
@@ -221,16 +141,31 @@ for (int i = 1; i < nlocal; i++) {
         std::cout << "Expected sorted elements: " << n << std::endl;
 
         // Check if the sorted array is valid
-        bool is_sorted = std::is_sorted(vsorted, vsorted + nsorted);
+        bool is_sorted = std::is_sorted(vsorted.begin(), vsorted.end());
         std::cout << "Is the sorted array valid? " << (is_sorted ? "Yes" : "No") << std::endl;
+        std::cout << "Bucket exchange: " << (exchange == SAMPLE_SORT_RMA ? "rma" : "alltoallv") << std::endl;
         std::cout << "Sorting time: " << etime - stime << " sec" << std::endl;
+        if (rebalance) {
+            std::cout << "Rebalance: moved " << rebalance_stats.moved << " of " << rebalance_stats.n
+                      << " elements into blocks of " << rebalance_stats.block << ", at most "
+                      << rebalance_stats.max_peers << " peers per rank" << std::endl;
+            bool exact = true;
+            for (int i = 0; i < npes; i++)
+                exact = exact && total_counts[i] == std::max(0LL, std::min(rebalance_stats.block,
+                                                                           n - i * rebalance_stats.block));
+            std::cout << "Exact blocks? " << (exact ? "Yes" : "No") << std::endl;
+            std::cout << "Rebalance time: " << rebalance_time << " sec" << std::endl;
+        }
     }
     CALI_MARK_END("correctness_check");
 
     delete[] elmnts;
-    delete[] vsorted;
     delete[] total_counts;
 
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+    run_codec_finalize(MPI_COMM_WORLD);
+
     mgr.stop();
     mgr.flush();
 
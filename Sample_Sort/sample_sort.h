@@ -0,0 +1,295 @@
+/******************************************************************************
+ * FILE: sample_sort.h
+ * DESCRIPTION:
+ *   Sample Sort kernel shared by the sample sort driver and the sort service.
+ *   SampleSortLocal keeps all scratch and the result in a SampleSortBuffers
+ *   object so callers that sort repeatedly can reuse the allocations; the
+ *   storage comes from the buffer arena, so even one-shot SampleSort calls
+ *   reuse the blocks of earlier calls.
+ *
+ *   Two bucket exchanges are available. SAMPLE_SORT_ALLTOALLV swaps counts
+ *   with an Alltoall and then moves the buckets with one Alltoallv.
+ *   SAMPLE_SORT_RMA derives every bucket's offset in its destination buffer
+ *   from an Exscan of the counts and MPI_Puts each bucket, and its count, into
+ *   a window that lives in SampleSortBuffers: it is allocated on first use,
+ *   kept locked (passive target) and only re-created when a larger receive
+ *   size shows up. Each sort then costs the two count reductions, the puts,
+ *   a flush and one barrier that tells every target its data is complete.
+ *   Release the window with SampleSortFree.
+ * AUTHOR:
+ *   Mustafa Tekin
+ ******************************************************************************/
+
+#ifndef SAMPLE_SORT_H
+#define SAMPLE_SORT_H
+
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+#include <caliper/cali.h>
+#include <climits>
+#include <cstring>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "stable_sort.h"
+#include "buffer_arena.h"
+#include "run_codec.h"
+
+// Scratch and output arrays; vectors only grow, so reusing one object across
+// sorts avoids reallocating once the largest job has been seen. The RMA
+// exchange also keeps its window here (see SampleSortFree).
+struct SampleSortBuffers {
+    arena_vector<int> splitters;
+    arena_vector<int> allpicks;
+    arena_vector<long long> scounts;
+    arena_vector<long long> sdispls;
+    arena_vector<long long> rcounts;
+    arena_vector<long long> rdispls;
+    arena_vector<int> sorted;
+    arena_vector<int> merge_tmp;
+    arena_vector<long long> put_displs;
+    arena_vector<long long> recv_totals;
+    // RMA window: npes long long counts, then win_capacity ints of data
+    MPI_Win win;
+    MPI_Comm win_comm;
+    long long win_capacity;
+    unsigned char* win_base;
+
+    SampleSortBuffers() : win(MPI_WIN_NULL), win_comm(MPI_COMM_NULL), win_capacity(0), win_base(NULL) {}
+};
+
+// Collective over the communicator of the last RMA sort; frees the window.
+// Does nothing if buf never used the RMA exchange.
+inline void SampleSortFree(SampleSortBuffers& buf) {
+    if (buf.win == MPI_WIN_NULL)
+        return;
+    MPI_Win_unlock_all(buf.win);
+    MPI_Win_free(&buf.win);
+    buf.win_comm = MPI_COMM_NULL;
+    buf.win_capacity = 0;
+    buf.win_base = NULL;
+}
+
+enum SampleSortExchange {
+    SAMPLE_SORT_ALLTOALLV,
+    SAMPLE_SORT_RMA
+};
+
+// One-sided bucket exchange: buf.scounts/sdispls describe the local buckets;
+// fills buf.sorted with the received buckets in source-rank order and
+// buf.rcounts/rdispls with their layout, as the Alltoallv path does.
+inline void SampleSortExchangeRMA(const int* elmnts, SampleSortBuffers& buf, long long* nsorted, MPI_Comm comm) {
+    int npes, myrank;
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &myrank);
+    const long long* scounts = buf.scounts.data();
+    const long long* sdispls = buf.sdispls.data();
+
+    // Where this rank's bucket lands in every destination buffer (the sum
+    // of what lower ranks send there), and every rank's receive size
+    buf.put_displs.assign(npes, 0);
+    buf.recv_totals.resize(npes);
+    comm_trace_phase("bucket_offsets");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Exscan(scounts, buf.put_displs.data(), npes, MPI_LONG_LONG, MPI_SUM, comm);
+    if (myrank == 0)
+        buf.put_displs.assign(npes, 0);
+    trace_Allreduce(scounts, buf.recv_totals.data(), npes, MPI_LONG_LONG, MPI_SUM, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    *nsorted = buf.recv_totals[myrank];
+
+    // Every rank sees the same totals, so all agree on whether the window
+    // has to grow; it grows by half again to make re-creation rare
+    long long largest = *std::max_element(buf.recv_totals.begin(), buf.recv_totals.end());
+    MPI_Aint header = (MPI_Aint)npes * sizeof(long long);
+    if (buf.win == MPI_WIN_NULL || buf.win_comm != comm || largest > buf.win_capacity) {
+        long long capacity = std::max(largest, buf.win_capacity + buf.win_capacity / 2);
+        SampleSortFree(buf);
+        MPI_Win_allocate(header + (MPI_Aint)(capacity * sizeof(int)), 1, MPI_INFO_NULL, comm, &buf.win_base,
+                         &buf.win);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, buf.win);
+        buf.win_comm = comm;
+        buf.win_capacity = capacity;
+    }
+
+    // Every target gets a count (zero included), so no slot is left over
+    // from the previous sort
+    comm_trace_phase("bucket_exchange");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_large");
+    for (int k = 0; k < npes; k++) {
+        // Start with the next rank so targets are not all hit in the same order
+        int dest = (myrank + k) % npes;
+        if (scounts[dest] > 0)
+            large_Put(elmnts + sdispls[dest], scounts[dest], MPI_INT, dest,
+                      header + (MPI_Aint)(buf.put_displs[dest] * sizeof(int)), buf.win, comm);
+        trace_Put(&scounts[dest], 1, MPI_LONG_LONG, dest, (MPI_Aint)myrank * sizeof(long long), buf.win, comm);
+    }
+    // The flush completes the puts at their targets; the barrier tells every
+    // target that all puts into it are done
+    MPI_Win_flush_all(buf.win);
+    MPI_Barrier(comm);
+    MPI_Win_sync(buf.win);
+    CALI_MARK_END("comm_large");
+    CALI_MARK_END("comm");
+
+    buf.rcounts.resize(npes);
+    buf.rdispls.assign(npes, 0);
+    memcpy(buf.rcounts.data(), buf.win_base, header);
+    for (int r = 1; r < npes; r++)
+        buf.rdispls[r] = buf.rdispls[r - 1] + buf.rcounts[r - 1];
+    const int* received = (const int*)(buf.win_base + header);
+    buf.sorted.assign(received, received + *nsorted);
+}
+
+// Sorts nlocal keys on this rank (nlocal may differ between ranks). The
+// returned pointer is buf.sorted.data() and stays valid until the next call.
+// With stable set, equal keys keep their global input order: the local sort
+// is stable, the exchange lays blocks out in source-rank order and the final
+// step is a stable merge of those runs instead of a re-sort.
+inline int* SampleSortLocal(long long nlocal, int* elmnts, long long* nsorted, SampleSortBuffers& buf, MPI_Comm comm,
+                            bool stable = false, SampleSortExchange exchange = SAMPLE_SORT_ALLTOALLV) {
+    int npes, myrank;
+    long long i, j;
+
+    // Establishing communicator-related information 
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &myrank);
+
+    // Storage for the splitters
+    buf.splitters.resize(npes);
+    buf.allpicks.resize((long long)npes * (npes - 1));
+    int* splitters = buf.splitters.data();
+    int* allpicks = buf.allpicks.data();
+
+    // Sort local array using std::sort 
+    CALI_MARK_BEGIN("comp_small");
+    if (stable)
+        std::stable_sort(elmnts, elmnts + nlocal);
+    else
+        std::sort(elmnts, elmnts + nlocal);
+    CALI_MARK_END("comp_small");
+
+
+    // Select local npes-1 equally spaced elements 
+    for (i = 1; i < npes; i++)
+        splitters[i - 1] = nlocal > 0 ? elmnts[i * nlocal / npes] : INT_MAX;
+
+    // Gather the samples in the processors 
+    comm_trace_phase("splitters");
+    CALI_MARK_BEGIN("comp_large");
+    trace_Allgather(splitters, npes - 1, MPI_INT, allpicks, npes - 1, MPI_INT, comm);
+    CALI_MARK_END("comp_large");
+
+
+    // Sort the samples using std::sort 
+
+    CALI_MARK_BEGIN("comp_small");
+    std::sort(allpicks, allpicks + (long long)npes * (npes - 1));
+    CALI_MARK_END("comp_small");    
+
+    CALI_MARK_BEGIN("comm"); 
+    CALI_MARK_BEGIN("comm_small");
+    // Pick splitters: every (npes-1)-th of the npes*(npes-1) samples, so the
+    // last pick stays inside allpicks
+    for (i = 1; i < npes; i++)
+        splitters[i - 1] = allpicks[i * (npes - 1)];
+    splitters[npes - 1] = INT_MAX;
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm"); 
+
+    // comm large the number of elements that belong to each bucket: the
+    // local keys are sorted, so bucket j ends at the first key >= splitters[j]
+    CALI_MARK_BEGIN("comm"); 
+    CALI_MARK_BEGIN("comm_large");
+    buf.scounts.assign(npes, 0);
+    long long* scounts = buf.scounts.data();
+    for (j = i = 0; i < npes; i++) {
+        long long end = i == npes - 1 ? nlocal : std::lower_bound(elmnts + j, elmnts + nlocal, splitters[i]) - elmnts;
+        scounts[i] = end - j;
+        j = end;
+    }
+    CALI_MARK_END("comm_large");
+    CALI_MARK_END("comm"); 
+
+
+
+    // Determine the starting location of each bucket's elements in the elmnts array 
+    
+    buf.sdispls.assign(npes, 0);
+    long long* sdispls = buf.sdispls.data();
+    for (i = 1; i < npes; i++)
+        sdispls[i] = sdispls[i - 1] + scounts[i - 1];
+
+    // A single rank has nothing to exchange (and some MPI builds offer no
+    // one-sided component for it)
+    if (exchange == SAMPLE_SORT_RMA && npes > 1) {
+        SampleSortExchangeRMA(elmnts, buf, nsorted, comm);
+    } else {
+        // Perform an all-to-all to inform the corresponding processes of the number of elements 
+        buf.rcounts.resize(npes);
+        long long* rcounts = buf.rcounts.data();
+        comm_trace_phase("bucket_counts");
+        CALI_MARK_BEGIN("comm"); 
+        CALI_MARK_BEGIN("comm_large");
+        int path = large_count_exchange(scounts, sdispls, rcounts, comm);
+        CALI_MARK_END("comm_large");
+        CALI_MARK_END("comm"); 
+
+        // Based on rcounts determine where in the local array the data from each processor 
+        // will be stored. This array will store the received elements as well as the final 
+        // sorted sequence
+        buf.rdispls.assign(npes, 0);
+        long long* rdispls = buf.rdispls.data();
+        for (i = 1; i < npes; i++)
+            rdispls[i] = rdispls[i - 1] + rcounts[i - 1];
+        *nsorted = rdispls[npes - 1] + rcounts[npes - 1];
+        buf.sorted.resize(*nsorted);
+        int* sorted_elmnts = buf.sorted.data();
+
+        // Each process sends and receives the corresponding elements 
+        comm_trace_phase("bucket_exchange");
+        CALI_MARK_BEGIN("comm"); 
+        // Buckets are sorted runs, so they compress well (SORT_COMPRESS)
+        if (run_codec_enabled())
+            compressed_Alltoallv(elmnts, scounts, sdispls, sorted_elmnts, rcounts, rdispls, comm);
+        else
+            large_Alltoallv(elmnts, scounts, sdispls, sorted_elmnts, rcounts, rdispls, MPI_INT, comm, path);
+        CALI_MARK_END("comm"); 
+    }
+    long long* rcounts = buf.rcounts.data();
+    long long* rdispls = buf.rdispls.data();
+    int* sorted_elmnts = buf.sorted.data();
+
+
+    // Perform the final local sort
+
+ 
+    CALI_MARK_BEGIN("comp_small"); 
+    if (stable)
+        merge_sorted_runs(sorted_elmnts, rdispls, rcounts, npes, buf.merge_tmp);
+    else
+        std::sort(sorted_elmnts, sorted_elmnts + (*nsorted));
+    CALI_MARK_END("comp_small");
+
+    return sorted_elmnts;
+}
+
+// Sorts n / npes keys per rank into sorted. The result buffer is swapped
+// out of the scratch buffers, not copied, so sorted owns the arena block
+// and returns it to the arena when it is destroyed.
+inline void SampleSort(long long n, int* elmnts, arena_vector<int>& sorted, MPI_Comm comm, bool stable = false,
+                       SampleSortExchange exchange = SAMPLE_SORT_ALLTOALLV) {
+    int npes;
+    long long nsorted;
+    MPI_Comm_size(comm, &npes);
+
+    SampleSortBuffers buf;
+    SampleSortLocal(n / npes, elmnts, &nsorted, buf, comm, stable, exchange);
+    SampleSortFree(buf);
+    sorted.swap(buf.sorted);
+}
+
+#endif
@@ -0,0 +1,327 @@
+/******************************************************************************
+ * FILE: segmented_sort.h
+ * DESCRIPTION:
+ *   Batched segmented sort: sorts many independent segments in one call.
+ *   Every rank passes the pieces of segments it holds (a segment may be
+ *   spread over several ranks). Segment sizes are summed with one Allreduce,
+ *   then every rank derives the same plan:
+ *     - segments larger than the threshold (default n/p) get a group of
+ *       consecutive ranks sized in proportion to the segment and are split
+ *       over it by value at sampled splitters
+ *     - all other segments go whole to one owner rank, assigned largest
+ *       first to the least loaded rank
+ *   For the large segments every rank sorts its own keys of the segment and
+ *   contributes weighted regular samples (SEGMENT_OVERSAMPLE per group rank,
+ *   each weighted by the keys it stands for) to one Allgather; all ranks pick
+ *   the same splitters from them. Every key then goes straight to its final
+ *   rank in a single Alltoallv and each rank sorts what it received, so keys
+ *   cross the network once and no sub-communicator is needed.
+ ******************************************************************************/
+
+#ifndef SEGMENTED_SORT_H
+#define SEGMENTED_SORT_H
+
+#include <vector>
+#include <queue>
+#include <map>
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <mpi.h>
+#include <caliper/cali.h>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "buffer_arena.h"
+
+// Local input: piece k belongs to segment seg_ids[k] and holds
+// keys[offsets[k] .. offsets[k + 1])
+struct SegmentedBatch {
+    std::vector<long long> seg_ids;
+    std::vector<long long> offsets;
+    std::vector<int> keys;
+};
+
+// Local output, same layout as the input. Whole segments have part 0 of
+// num_parts 1; a cooperatively sorted segment is returned as num_parts
+// consecutive slices, slice i on the i-th rank of its group.
+struct SegmentedResult {
+    std::vector<long long> seg_ids;
+    std::vector<int> parts;
+    std::vector<int> num_parts;
+    std::vector<long long> offsets;
+    std::vector<int> keys;
+};
+
+// Wire record header: segment id and key count, each as two 32-bit halves
+#define SEGMENT_HEADER_INTS 4
+// Samples per group rank that every rank contributes for a large segment
+#define SEGMENT_OVERSAMPLE 4
+
+inline void segment_put_ll(int* p, long long v) {
+    p[0] = (int)(v & 0xffffffffLL);
+    p[1] = (int)(v >> 32);
+}
+
+inline long long segment_get_ll(const int* p) {
+    return ((long long)p[1] << 32) | (unsigned int)p[0];
+}
+
+inline void SegmentedSort(const SegmentedBatch& in, long long nsegments, SegmentedResult& out,
+                          MPI_Comm comm, long long large_threshold = 0) {
+    int npes, myrank;
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &myrank);
+    long long npieces = (long long)in.seg_ids.size();
+
+    // Global segment sizes
+    std::vector<long long> local_sizes(nsegments, 0), sizes(nsegments);
+    for (long long k = 0; k < npieces; k++)
+        local_sizes[in.seg_ids[k]] += in.offsets[k + 1] - in.offsets[k];
+    comm_trace_phase("segment_sizes");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Allreduce(local_sizes.data(), sizes.data(), (int)nsegments, MPI_LONG_LONG, MPI_SUM, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    // Plan, computed identically on every rank
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    long long total = 0;
+    for (long long s = 0; s < nsegments; s++)
+        total += sizes[s];
+    long long fair = std::max(1LL, (total + npes - 1) / npes);
+    long long threshold = large_threshold > 0 ? large_threshold : fair;
+
+    std::vector<long long> order(nsegments);
+    for (long long s = 0; s < nsegments; s++)
+        order[s] = s;
+    std::sort(order.begin(), order.end(), [&](long long a, long long b) {
+        return sizes[a] != sizes[b] ? sizes[a] > sizes[b] : a < b;
+    });
+
+    // owner[s] >= 0 is the rank sorting s locally; -1 - g means rank group g
+    std::vector<long long> owner(nsegments);
+    std::vector<long long> group_seg, group_first, group_size;
+    std::vector<long long> load(npes, 0);
+    int next_rank = 0;
+    long long first_small = 0;
+    for (; first_small < nsegments; first_small++) {
+        long long s = order[first_small];
+        if (sizes[s] <= threshold)
+            break;
+        long long q = std::min((long long)(npes - next_rank), std::max(2LL, (sizes[s] + fair / 2) / fair));
+        if (q < 2)
+            break;
+        owner[s] = -1 - (long long)group_seg.size();
+        group_seg.push_back(s);
+        group_first.push_back(next_rank);
+        group_size.push_back(q);
+        for (long long r = next_rank; r < next_rank + q; r++)
+            load[r] += sizes[s] / q;
+        next_rank += (int)q;
+    }
+
+    // Remaining segments go to the least loaded rank, largest first
+    typedef std::pair<long long, int> RankLoad;
+    std::priority_queue<RankLoad, std::vector<RankLoad>, std::greater<RankLoad> > ranks;
+    for (int r = 0; r < npes; r++)
+        ranks.push(RankLoad(load[r], r));
+    for (long long i = first_small; i < nsegments; i++) {
+        long long s = order[i];
+        RankLoad least = ranks.top();
+        ranks.pop();
+        owner[s] = least.second;
+        least.first += sizes[s];
+        ranks.push(least);
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    // This rank's keys of every large segment, sorted, and their samples:
+    // (key, number of keys it stands for) pairs, zero weight when the rank
+    // holds none of the segment
+    size_t ngroups = group_seg.size();
+    std::vector<arena_vector<int> > group_local(ngroups);
+    for (long long k = 0; k < npieces; k++) {
+        long long s = in.seg_ids[k];
+        if (owner[s] < 0)
+            group_local[-1 - owner[s]].insert(group_local[-1 - owner[s]].end(), in.keys.begin() + in.offsets[k],
+                                              in.keys.begin() + in.offsets[k + 1]);
+    }
+    std::vector<long long> sample_first(ngroups + 1, 0);
+    for (size_t g = 0; g < ngroups; g++)
+        sample_first[g + 1] = sample_first[g] + SEGMENT_OVERSAMPLE * group_size[g];
+    std::vector<long long> samples(2 * sample_first[ngroups]);
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_large");
+    for (size_t g = 0; g < ngroups; g++) {
+        std::sort(group_local[g].begin(), group_local[g].end());
+        long long c = (long long)group_local[g].size(), m = sample_first[g + 1] - sample_first[g];
+        for (long long i = 0; i < m; i++) {
+            long long lo = c * i / m, hi = c * (i + 1) / m;
+            samples[2 * (sample_first[g] + i)] = hi > lo ? group_local[g][lo] : 0;
+            samples[2 * (sample_first[g] + i) + 1] = hi - lo;
+        }
+    }
+    CALI_MARK_END("comp_large");
+    CALI_MARK_END("comp");
+
+    // Splitter j of group g: the first sample with at least j / q of the
+    // segment's weight before it. Every rank gets the same result.
+    std::vector<std::vector<int> > splitters(ngroups);
+    if (ngroups > 0) {
+        long long nsamples = 2 * sample_first[ngroups];
+        std::vector<long long> all_samples(nsamples * npes);
+        comm_trace_phase("segment_samples");
+        CALI_MARK_BEGIN("comm");
+        CALI_MARK_BEGIN("comm_small");
+        trace_Allgather(samples.data(), (int)nsamples, MPI_LONG_LONG, all_samples.data(), (int)nsamples,
+                        MPI_LONG_LONG, comm);
+        CALI_MARK_END("comm_small");
+        CALI_MARK_END("comm");
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        for (size_t g = 0; g < ngroups; g++) {
+            std::vector<std::pair<long long, long long> > picks;
+            for (int r = 0; r < npes; r++) {
+                const long long* rs = &all_samples[r * nsamples];
+                for (long long i = sample_first[g]; i < sample_first[g + 1]; i++)
+                    if (rs[2 * i + 1] > 0)
+                        picks.push_back(std::make_pair(rs[2 * i], rs[2 * i + 1]));
+            }
+            std::sort(picks.begin(), picks.end());
+            long long q = group_size[g], before = 0;
+            size_t next = 0;
+            for (long long j = 1; j < q; j++) {
+                long long target = sizes[group_seg[g]] * j / q;
+                while (next < picks.size() && before < target)
+                    before += picks[next++].second;
+                splitters[g].push_back(next < picks.size() ? (int)picks[next].first : INT_MAX);
+            }
+        }
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+    }
+
+    // Pack one record per (piece, destination) for whole segments and one
+    // per (large segment, group rank) for the value-split ones
+    std::vector<long long> scounts(npes, 0), sdispls(npes, 0), rcounts(npes), rdispls(npes, 0);
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<long long> cursor(sdispls);
+        for (long long k = 0, g = -1; k < npieces + (long long)ngroups; k++) {
+            const int* keys;
+            long long s, count, dest;
+            if (k < npieces) {
+                s = in.seg_ids[k];
+                count = in.offsets[k + 1] - in.offsets[k];
+                if (count == 0 || owner[s] < 0)
+                    continue;
+                keys = in.keys.data() + in.offsets[k];
+                dest = owner[s];
+            } else {
+                g = k - npieces;
+                s = group_seg[g];
+                keys = group_local[g].data();
+                count = (long long)group_local[g].size();
+                dest = group_first[g];
+            }
+            long long q = k < npieces ? 1 : group_size[g];
+            for (long long j = 0, lo = 0; j < q; j++) {
+                long long hi = j == q - 1 ? count
+                                          : std::lower_bound(keys + lo, keys + count, splitters[g][j]) - keys;
+                if (hi > lo) {
+                    int d = (int)(dest + j);
+                    if (pass == 0) {
+                        scounts[d] += SEGMENT_HEADER_INTS + (hi - lo);
+                    } else {
+                        int* rec = out.keys.data() + cursor[d];
+                        segment_put_ll(rec, s);
+                        segment_put_ll(rec + 2, hi - lo);
+                        std::copy(keys + lo, keys + hi, rec + SEGMENT_HEADER_INTS);
+                        cursor[d] += SEGMENT_HEADER_INTS + (hi - lo);
+                    }
+                }
+                lo = hi;
+            }
+        }
+        if (pass == 0) {
+            for (int r = 1; r < npes; r++)
+                sdispls[r] = sdispls[r - 1] + scounts[r - 1];
+            // out.keys doubles as the send buffer until the exchange is done
+            out.keys.resize(sdispls[npes - 1] + scounts[npes - 1]);
+        }
+    }
+
+    comm_trace_phase("segment_counts");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Alltoall(scounts.data(), 1, MPI_LONG_LONG, rcounts.data(), 1, MPI_LONG_LONG, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    for (int r = 1; r < npes; r++)
+        rdispls[r] = rdispls[r - 1] + rcounts[r - 1];
+    arena_vector<int> recv(rdispls[npes - 1] + rcounts[npes - 1]);
+
+    comm_trace_phase("segment_exchange");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_large");
+    large_Alltoallv(out.keys.data(), scounts.data(), sdispls.data(),
+                    recv.data(), rcounts.data(), rdispls.data(), MPI_INT, comm);
+    CALI_MARK_END("comm_large");
+    CALI_MARK_END("comm");
+
+    // Lay out the owned whole segments in id order, then the group slice
+    int my_group = -1;
+    for (size_t g = 0; g < group_seg.size(); g++) {
+        if (myrank >= group_first[g] && myrank < group_first[g] + group_size[g])
+            my_group = (int)g;
+    }
+    out.seg_ids.clear();
+    out.parts.clear();
+    out.num_parts.clear();
+    out.offsets.assign(1, 0);
+    std::vector<long long> write_pos(nsegments, -1);
+    for (long long s = 0; s < nsegments; s++) {
+        if (owner[s] == myrank && sizes[s] > 0) {
+            write_pos[s] = out.offsets.back();
+            out.seg_ids.push_back(s);
+            out.parts.push_back(0);
+            out.num_parts.push_back(1);
+            out.offsets.push_back(out.offsets.back() + sizes[s]);
+        }
+    }
+    long long whole_keys = out.offsets.back();
+    out.keys.resize(whole_keys);
+    arena_vector<int> group_keys;
+
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_large");
+    for (size_t pos = 0; pos < recv.size();) {
+        long long s = segment_get_ll(&recv[pos]);
+        long long count = segment_get_ll(&recv[pos + 2]);
+        const int* keys = &recv[pos + SEGMENT_HEADER_INTS];
+        if (owner[s] >= 0) {
+            std::copy(keys, keys + count, out.keys.begin() + write_pos[s]);
+            write_pos[s] += count;
+        } else {
+            group_keys.insert(group_keys.end(), keys, keys + count);
+        }
+        pos += SEGMENT_HEADER_INTS + count;
+    }
+    for (size_t i = 0; i < out.seg_ids.size(); i++)
+        std::sort(out.keys.begin() + out.offsets[i], out.keys.begin() + out.offsets[i + 1]);
+    // This rank's slice of its large segment, which may be empty
+    if (my_group >= 0) {
+        std::sort(group_keys.begin(), group_keys.end());
+        out.seg_ids.push_back(group_seg[my_group]);
+        out.parts.push_back(myrank - (int)group_first[my_group]);
+        out.num_parts.push_back((int)group_size[my_group]);
+        out.keys.insert(out.keys.end(), group_keys.begin(), group_keys.end());
+        out.offsets.push_back(out.offsets.back() + (long long)group_keys.size());
+    }
+    CALI_MARK_END("comp_large");
+    CALI_MARK_END("comp");
+}
+
+#endif
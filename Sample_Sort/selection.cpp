@@ -0,0 +1,156 @@
+/******************************************************************************
+ * FILE: selection.cpp
+ * DESCRIPTION:
+ *   Driver for the distributed selection queries (selection.h) with Caliper
+ *   instrumentation. Computes the p50/p99/p999 quantiles and the top-k keys
+ *   of random data, checks every answer against global counts, and times a
+ *   full SampleSort of the same data for comparison.
+ *
+ *   Usage: mpirun -np <p> ./selection <n> [k]
+ ******************************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+#include <cstdlib>
+#include <caliper/cali.h>
+#include <caliper/cali-manager.h>
+#include <climits>
+#include "comm_trace.h"
+#include "sample_sort.h"
+#include "selection.h"
+
+// Global rank range [less, less_equal) covered by key
+void global_rank_of(const int* elmnts, long long nlocal, int key, long long* less, long long* less_equal) {
+    long long local[2] = {0, 0}, global[2];
+    for (long long i = 0; i < nlocal; i++) {
+        local[0] += elmnts[i] < key;
+        local[1] += elmnts[i] <= key;
+    }
+    MPI_Allreduce(local, global, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    *less = global[0];
+    *less_equal = global[1];
+}
+
+int main(int argc, char* argv[]) {
+    CALI_CXX_MARK_FUNCTION;
+    int npes, myrank;
+    long long n, nlocal, k = 10;
+    double stime, etime;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &npes);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+
+    cali::ConfigManager mgr;
+    mgr.start();
+
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
+    if (argc < 2) {
+        if (myrank == 0) {
+            std::cout << "Usage: mpiexec -n <p> " << argv[0] << " <n> [k]" << std::endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    n = atoll(argv[1]);
+    if (argc >= 3)
+        k = atoll(argv[2]);
+    nlocal = n / npes;
+    n = nlocal * npes;
+
+    int* elmnts = new int[nlocal > 0 ? nlocal : 1];
+    CALI_MARK_BEGIN("data_init_runtime");
+    srand(myrank);
+    for (long long i = 0; i < nlocal; i++) {
+        elmnts[i] = rand() % (10 * n + 1);
+    }
+    CALI_MARK_END("data_init_runtime");
+
+    std::vector<double> qs;
+    qs.push_back(0.5);
+    qs.push_back(0.99);
+    qs.push_back(0.999);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    CALI_MARK_BEGIN("quantiles");
+    std::vector<int> qv = quantiles(elmnts, nlocal, qs, MPI_COMM_WORLD);
+    CALI_MARK_END("quantiles");
+    etime = MPI_Wtime();
+    double quantile_time = etime - stime;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    CALI_MARK_BEGIN("top_k");
+    std::vector<int> top = top_k(elmnts, nlocal, k, 0, MPI_COMM_WORLD);
+    CALI_MARK_END("top_k");
+    etime = MPI_Wtime();
+    double top_k_time = etime - stime;
+
+    CALI_MARK_BEGIN("correctness_check");
+    bool ok = true;
+    for (size_t i = 0; i < qs.size(); i++) {
+        long long less, less_equal;
+        long long target = (long long)(qs[i] * (double)(n - 1));
+        global_rank_of(elmnts, nlocal, qv[i], &less, &less_equal);
+        if (!(less <= target && target < less_equal))
+            ok = false;
+    }
+    // The k-th largest must sit at rank n - k, and the answer must be descending
+    int kth_largest = myrank == 0 && !top.empty() ? top.back() : 0;
+    MPI_Bcast(&kth_largest, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (k > 0 && k <= n) {
+        long long less, less_equal;
+        global_rank_of(elmnts, nlocal, kth_largest, &less, &less_equal);
+        if (!(less <= n - k && n - k < less_equal))
+            ok = false;
+    }
+    if (myrank == 0 && ((long long)top.size() != std::min(k, n) ||
+                        !std::is_sorted(top.begin(), top.end(), [](int a, int b) { return a > b; })))
+        ok = false;
+    CALI_MARK_END("correctness_check");
+
+    // Full sort of a copy, for comparison
+    int* copy = new int[nlocal > 0 ? nlocal : 1];
+    std::copy(elmnts, elmnts + nlocal, copy);
+    arena_vector<int> vsorted;
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    SampleSort(n, copy, vsorted, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    etime = MPI_Wtime();
+    double sort_time = etime - stime;
+
+    if (myrank == 0) {
+        std::cout << "p50 " << qv[0] << ", p99 " << qv[1] << ", p999 " << qv[2] << std::endl;
+        std::cout << "Top " << top.size() << ":";
+        for (size_t i = 0; i < std::min(top.size(), (size_t)10); i++)
+            std::cout << " " << top[i];
+        std::cout << (top.size() > 10 ? " ..." : "") << std::endl;
+        std::cout << "Are the answers valid? " << (ok ? "Yes" : "No") << std::endl;
+        std::cout << "Quantile time: " << quantile_time << " sec" << std::endl;
+        std::cout << "Top-k time: " << top_k_time << " sec" << std::endl;
+        std::cout << "Full SampleSort time: " << sort_time << " sec" << std::endl;
+    }
+
+    delete[] elmnts;
+    delete[] copy;
+
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+    run_codec_finalize(MPI_COMM_WORLD);
+
+    mgr.stop();
+    mgr.flush();
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,283 @@
+/******************************************************************************
+ * FILE: selection.h
+ * DESCRIPTION:
+ *   Distributed selection without a full sort: select_kth, quantiles and
+ *   top_k over keys spread across ranks.
+ *
+ *   Each round every rank draws random samples from its still-active keys
+ *   (in proportion to how many it has), the samples are Allgathered, and two
+ *   pivots bracketing the target rank are taken from the sorted sample. One
+ *   Allreduce of the counts below/between the pivots tells every rank which
+ *   of the three ranges holds the target; the other two are dropped locally.
+ *   Once few enough keys remain they are gathered on a root and the answer is
+ *   picked there. Local work is O(n/p) in expectation and each round shrinks
+ *   the active set by roughly sqrt(sample size). When all active keys already
+ *   lie between the pivots (few distinct values), the round splits off the
+ *   copies of the lower pivot instead, so every round makes progress.
+ *
+ *   Sampling uses a private generator; the caller's rand() state is left
+ *   alone.
+ ******************************************************************************/
+
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <climits>
+#include <random>
+#include <mpi.h>
+#include <caliper/cali.h>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "buffer_arena.h"
+
+// Samples drawn per round across all ranks
+#define SELECT_SAMPLE_SIZE 1024
+// Active keys below which the remaining candidates are gathered on the root
+#define SELECT_GATHER_LIMIT 8192
+
+// Key of global rank k (0-based, ascending) over all ranks' elmnts; the
+// input is not modified. Every rank gets the result. rounds, if given,
+// receives the number of narrowing rounds.
+inline int select_kth(const int* elmnts, long long nlocal, long long k, MPI_Comm comm, int* rounds = NULL) {
+    int npes, myrank;
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &myrank);
+
+    arena_vector<int> active(elmnts, elmnts + nlocal);
+    long long n_active;
+    comm_trace_phase("select_rounds");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Allreduce(&nlocal, &n_active, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    k = std::max(0LL, std::min(k, n_active - 1));
+
+    std::vector<int> sample_counts(npes), sample_displs(npes);
+    std::vector<int> samples, all_samples;
+    std::mt19937 rng(myrank * 7919 + 17);
+    int round = 0;
+
+    while (n_active > SELECT_GATHER_LIMIT) {
+        long long local_active = (long long)active.size();
+
+        // Samples in proportion to the local share of active keys
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        int nsamples = (int)std::min(local_active, (SELECT_SAMPLE_SIZE * local_active + n_active - 1) / n_active);
+        samples.resize(nsamples);
+        std::uniform_int_distribution<long long> pick(0, std::max(0LL, local_active - 1));
+        for (int i = 0; i < nsamples; i++)
+            samples[i] = active[pick(rng)];
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+
+        CALI_MARK_BEGIN("comm");
+        CALI_MARK_BEGIN("comm_small");
+        trace_Allgather(&nsamples, 1, MPI_INT, sample_counts.data(), 1, MPI_INT, comm);
+        sample_displs[0] = 0;
+        for (int r = 1; r < npes; r++)
+            sample_displs[r] = sample_displs[r - 1] + sample_counts[r - 1];
+        all_samples.resize(sample_displs[npes - 1] + sample_counts[npes - 1]);
+        trace_Allgatherv(samples.data(), nsamples, MPI_INT, all_samples.data(), sample_counts.data(),
+                         sample_displs.data(), MPI_INT, comm);
+        CALI_MARK_END("comm_small");
+        CALI_MARK_END("comm");
+
+        // Two pivots around the expected position of the target
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        std::sort(all_samples.begin(), all_samples.end());
+        long long m = (long long)all_samples.size();
+        long long pos = (long long)((double)k / n_active * m);
+        long long delta = (long long)std::sqrt((double)m) + 1;
+        int pivot_lo = all_samples[std::max(0LL, pos - delta)];
+        int pivot_hi = all_samples[std::min(m - 1, pos + delta)];
+
+        long long local_counts[2] = {0, 0}, counts[2];
+        for (long long i = 0; i < local_active; i++) {
+            local_counts[0] += active[i] < pivot_lo;
+            local_counts[1] += active[i] <= pivot_hi;
+        }
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+
+        CALI_MARK_BEGIN("comm");
+        CALI_MARK_BEGIN("comm_small");
+        trace_Allreduce(local_counts, counts, 2, MPI_LONG_LONG, MPI_SUM, comm);
+        CALI_MARK_END("comm_small");
+        CALI_MARK_END("comm");
+        round++;
+
+        // Keep only the range holding rank k
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        arena_vector<int>::iterator keep_end;
+        if (k < counts[0]) {
+            keep_end = std::partition(active.begin(), active.end(), [&](int x) { return x < pivot_lo; });
+            n_active = counts[0];
+        } else if (k < counts[1]) {
+            if (pivot_lo == pivot_hi) {
+                CALI_MARK_END("comp_small");
+                CALI_MARK_END("comp");
+                if (rounds != NULL)
+                    *rounds = round;
+                return pivot_lo;
+            }
+            if (counts[1] - counts[0] == n_active) {
+                // Nothing would be dropped: split off the copies of pivot_lo
+                long long local_eq = std::count(active.begin(), active.end(), pivot_lo), eq;
+                CALI_MARK_END("comp_small");
+                CALI_MARK_END("comp");
+                CALI_MARK_BEGIN("comm");
+                CALI_MARK_BEGIN("comm_small");
+                trace_Allreduce(&local_eq, &eq, 1, MPI_LONG_LONG, MPI_SUM, comm);
+                CALI_MARK_END("comm_small");
+                CALI_MARK_END("comm");
+                if (k < eq) {
+                    if (rounds != NULL)
+                        *rounds = round;
+                    return pivot_lo;
+                }
+                CALI_MARK_BEGIN("comp");
+                CALI_MARK_BEGIN("comp_small");
+                keep_end = std::partition(active.begin(), active.end(), [&](int x) { return x > pivot_lo; });
+                k -= eq;
+                n_active -= eq;
+            } else {
+                keep_end = std::partition(active.begin(), active.end(),
+                                          [&](int x) { return x >= pivot_lo && x <= pivot_hi; });
+                k -= counts[0];
+                n_active = counts[1] - counts[0];
+            }
+        } else {
+            keep_end = std::partition(active.begin(), active.end(), [&](int x) { return x > pivot_hi; });
+            k -= counts[1];
+            n_active = n_active - counts[1];
+        }
+        active.erase(keep_end, active.end());
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+    }
+
+    // Few candidates left: finish on the root
+    int nremaining = (int)active.size();
+    std::vector<int> remaining_counts(npes), remaining_displs(npes, 0), remaining;
+    comm_trace_phase("select_gather");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Gather(&nremaining, 1, MPI_INT, remaining_counts.data(), 1, MPI_INT, 0, comm);
+    if (myrank == 0) {
+        for (int r = 1; r < npes; r++)
+            remaining_displs[r] = remaining_displs[r - 1] + remaining_counts[r - 1];
+        remaining.resize(remaining_displs[npes - 1] + remaining_counts[npes - 1]);
+    }
+    trace_Gatherv(active.data(), nremaining, MPI_INT, remaining.data(), remaining_counts.data(),
+                  remaining_displs.data(), MPI_INT, 0, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    int result = 0;
+    if (myrank == 0) {
+        CALI_MARK_BEGIN("comp");
+        CALI_MARK_BEGIN("comp_small");
+        std::nth_element(remaining.begin(), remaining.begin() + k, remaining.end());
+        result = remaining[k];
+        CALI_MARK_END("comp_small");
+        CALI_MARK_END("comp");
+    }
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Bcast(&result, 1, MPI_INT, 0, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    if (rounds != NULL)
+        *rounds = round;
+    return result;
+}
+
+// Keys at the given fractions (0..1) of the global order, using the lower
+// nearest rank floor(q * (n - 1)). Every rank gets all results.
+inline std::vector<int> quantiles(const int* elmnts, long long nlocal, const std::vector<double>& qs, MPI_Comm comm) {
+    long long n;
+    trace_Allreduce(&nlocal, &n, 1, MPI_LONG_LONG, MPI_SUM, comm);
+
+    std::vector<int> result(qs.size());
+    for (size_t i = 0; i < qs.size(); i++) {
+        double q = std::max(0.0, std::min(1.0, qs[i]));
+        result[i] = select_kth(elmnts, nlocal, (long long)(q * (double)(n - 1)), comm);
+    }
+    return result;
+}
+
+// The k largest keys, in descending order, on root (empty on other ranks).
+// Ties at the cut-off are taken from the lowest ranks first.
+inline std::vector<int> top_k(const int* elmnts, long long nlocal, long long k, int root, MPI_Comm comm) {
+    int npes, myrank;
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &myrank);
+
+    long long n;
+    trace_Allreduce(&nlocal, &n, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    k = std::max(0LL, std::min(k, n));
+    std::vector<int> result;
+    if (k == 0)
+        return result;
+
+    int cutoff = select_kth(elmnts, nlocal, n - k, comm);
+
+    // Everything above the cut-off, plus just enough copies of it
+    long long local_counts[2] = {0, 0}, counts[2];
+    for (long long i = 0; i < nlocal; i++) {
+        local_counts[0] += elmnts[i] > cutoff;
+        local_counts[1] += elmnts[i] == cutoff;
+    }
+    long long ties_before = 0;
+    comm_trace_phase("top_k_gather");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Allreduce(local_counts, counts, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    trace_Exscan(&local_counts[1], &ties_before, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    if (myrank == 0)
+        ties_before = 0;
+    long long ties = std::max(0LL, std::min(local_counts[1], k - counts[0] - ties_before));
+
+    std::vector<int> mine;
+    mine.reserve(local_counts[0] + ties);
+    for (long long i = 0; i < nlocal; i++) {
+        if (elmnts[i] > cutoff)
+            mine.push_back(elmnts[i]);
+        else if (elmnts[i] == cutoff && ties > 0) {
+            mine.push_back(elmnts[i]);
+            ties--;
+        }
+    }
+
+    int nmine = (int)mine.size();
+    std::vector<int> recv_counts(npes), recv_displs(npes, 0);
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Gather(&nmine, 1, MPI_INT, recv_counts.data(), 1, MPI_INT, root, comm);
+    if (myrank == root) {
+        for (int r = 1; r < npes; r++)
+            recv_displs[r] = recv_displs[r - 1] + recv_counts[r - 1];
+        result.resize(recv_displs[npes - 1] + recv_counts[npes - 1]);
+    }
+    trace_Gatherv(mine.data(), nmine, MPI_INT, result.data(), recv_counts.data(), recv_displs.data(),
+                  MPI_INT, root, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    if (myrank == root)
+        std::sort(result.begin(), result.end(), [](int a, int b) { return a > b; });
+    return result;
+}
+
+#endif
@@ -0,0 +1,51 @@
+import array
+import os
+import random
+import sys
+import time
+
+# Submits random sort jobs to a running sortservice and checks the results.
+# Usage: python3 sort_client.py <queue_dir> <keys_per_job> [num_jobs] [--stop]
+
+if len(sys.argv) < 3:
+    print("Usage: python3 sort_client.py <queue_dir> <keys_per_job> [num_jobs] [--stop]")
+    sys.exit(1)
+
+queue_dir = sys.argv[1]
+keys_per_job = int(sys.argv[2])
+num_jobs = int(sys.argv[3]) if len(sys.argv) >= 4 and sys.argv[3] != "--stop" else 1
+send_stop = "--stop" in sys.argv
+
+os.makedirs(queue_dir, exist_ok=True)
+
+submitted = {}
+for j in range(num_jobs):
+    name = "job%08d_%d" % (j, os.getpid())
+    keys = array.array("i", (random.randint(0, 2**31 - 1) for _ in range(keys_per_job)))
+    tmp_path = os.path.join(queue_dir, name + ".tmp")
+    with open(tmp_path, "wb") as f:
+        keys.tofile(f)
+    # The rename makes the job visible to the service in one step
+    os.rename(tmp_path, os.path.join(queue_dir, name + ".job"))
+    submitted[name] = (sorted(keys), time.time())
+
+failed = 0
+while submitted:
+    for name in list(submitted):
+        path = os.path.join(queue_dir, name + ".sorted")
+        if not os.path.exists(path):
+            continue
+        expected, start = submitted.pop(name)
+        result = array.array("i")
+        with open(path, "rb") as f:
+            result.frombytes(f.read())
+        os.remove(path)
+        ok = list(result) == expected
+        failed += 0 if ok else 1
+        print(f"{name}: {'sorted' if ok else 'WRONG'} ({(time.time() - start) * 1e3:.1f} ms round trip)")
+    time.sleep(0.01)
+
+if send_stop:
+    open(os.path.join(queue_dir, "STOP"), "w").close()
+
+sys.exit(1 if failed else 0)
@@ -0,0 +1,281 @@
+/******************************************************************************
+ * FILE: sort_service.cpp
+ * DESCRIPTION:
+ *   Long-running Sample Sort service. MPI, Caliper and adiak are set up once;
+ *   the ranks then sort jobs taken from a spool directory until told to stop.
+ *   The communicator, the persistent requests that carry each job header and
+ *   all sort buffers are reused from one job to the next.
+ *
+ *   Usage: mpirun -np <p> ./sortservice <queue_dir> [poll_ms]
+ *
+ *   Queue protocol (see sort_client.py):
+ *     - a client writes raw native-endian 32-bit int keys to
+ *       <queue_dir>/<name>.tmp and renames it to <name>.job
+ *     - jobs are served in name order; the sorted keys are written to
+ *       <name>.sorted (via a temporary file and rename) and <name>.job is
+ *       removed
+ *     - creating <queue_dir>/STOP shuts the service down once the queue
+ *       is empty
+ ******************************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <mpi.h>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+#include <caliper/cali.h>
+#include <caliper/cali-manager.h>
+#include <adiak.hpp>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "sample_sort.h"
+
+#define SERVICE_HEADER_TAG 17
+
+// Job header sent from rank 0 to every rank over the persistent requests
+enum { HDR_SEQ = 0, HDR_N, HDR_STOP, HDR_LEN };
+
+// Oldest (lowest-named) .job file in the queue, or "" if there is none
+std::string next_job(const std::string& dir) {
+    std::string best;
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL)
+        return best;
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL) {
+        std::string name = e->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".job") == 0) {
+            if (best.empty() || name < best)
+                best = name;
+        }
+    }
+    closedir(d);
+    return best;
+}
+
+bool read_keys(const std::string& path, std::vector<int>& keys) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == NULL)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long long bytes = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    keys.resize(bytes / sizeof(int));
+    size_t got = keys.empty() ? 0 : fread(keys.data(), sizeof(int), keys.size(), f);
+    fclose(f);
+    return got == keys.size();
+}
+
+bool write_keys(const std::string& path, const int* keys, long long n) {
+    std::string tmp = path + ".part";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (f == NULL)
+        return false;
+    size_t put = n > 0 ? fwrite(keys, sizeof(int), n, f) : 0;
+    fclose(f);
+    if ((long long)put != n)
+        return false;
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    int npes, myrank;
+    double t_launch, t_ready;
+
+    MPI_Init(&argc, &argv);
+    t_launch = MPI_Wtime();
+
+    cali::ConfigManager mgr;
+    mgr.start();
+
+    MPI_Comm_size(MPI_COMM_WORLD, &npes);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+
+    if (argc < 2) {
+        if (myrank == 0)
+            std::cout << "Usage: mpirun -np <p> " << argv[0] << " <queue_dir> [poll_ms]" << std::endl;
+        MPI_Finalize();
+        return 1;
+    }
+    std::string queue_dir = argv[1];
+    int poll_ms = argc >= 3 ? atoi(argv[2]) : 10;
+
+    // Service-wide setup, paid once
+    MPI_Comm comm;
+    MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+    comm_trace_init(comm);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
+    adiak::init(NULL);
+    adiak::launchdate();
+    adiak::libraries();
+    adiak::cmdline();
+    adiak::clustername();
+    adiak::value("algorithm", "SampleSortService");
+    adiak::value("programming_model", "MPI");
+    adiak::value("data_type", "int");
+    adiak::value("size_of_data_type", sizeof(int));
+    adiak::value("num_procs", npes);
+    adiak::value("group_num", 21);
+    adiak::value("implementation_source", "Handwritten");
+
+    // Persistent requests for the fixed-size job header
+    long long header[HDR_LEN];
+    std::vector<MPI_Request> header_reqs;
+    if (myrank == 0) {
+        header_reqs.resize(npes - 1);
+        for (int r = 1; r < npes; r++)
+            MPI_Send_init(header, HDR_LEN, MPI_LONG_LONG, r, SERVICE_HEADER_TAG, comm, &header_reqs[r - 1]);
+    } else {
+        header_reqs.resize(1);
+        MPI_Recv_init(header, HDR_LEN, MPI_LONG_LONG, 0, SERVICE_HEADER_TAG, comm, &header_reqs[0]);
+    }
+
+    // Pooled buffers, grown to the largest job seen and never shrunk
+    std::vector<int> job_keys;
+    std::vector<int> local_keys;
+    std::vector<long long> counts(npes), displs(npes);
+    std::vector<long long> sorted_counts(npes), sorted_displs(npes);
+    SampleSortBuffers buf;
+
+    t_ready = MPI_Wtime();
+    if (myrank == 0) {
+        std::cout << "Sort service ready on " << npes << " ranks, setup "
+                  << (t_ready - t_launch) * 1e3 << " ms, queue " << queue_dir << std::endl;
+    }
+
+    long long jobs = 0, total_keys = 0;
+    double busy = 0.0, max_latency = 0.0;
+
+    while (true) {
+        std::string job;
+        double t_pickup = 0.0;
+
+        // Rank 0 waits for work; the other ranks block on the header
+        if (myrank == 0) {
+            header[HDR_STOP] = 0;
+            while (true) {
+                job = next_job(queue_dir);
+                if (!job.empty()) {
+                    t_pickup = MPI_Wtime();
+                    if (read_keys(queue_dir + "/" + job, job_keys))
+                        break;
+                    std::cerr << "Skipping unreadable job " << job << std::endl;
+                    remove((queue_dir + "/" + job).c_str());
+                    continue;
+                }
+                if (access((queue_dir + "/STOP").c_str(), F_OK) == 0) {
+                    header[HDR_STOP] = 1;
+                    break;
+                }
+                usleep(poll_ms * 1000);
+            }
+            header[HDR_SEQ] = jobs;
+            header[HDR_N] = header[HDR_STOP] ? 0 : (long long)job_keys.size();
+        }
+
+        if (!header_reqs.empty()) {
+            MPI_Startall((int)header_reqs.size(), header_reqs.data());
+            MPI_Waitall((int)header_reqs.size(), header_reqs.data(), MPI_STATUSES_IGNORE);
+        }
+        if (header[HDR_STOP])
+            break;
+
+        CALI_MARK_BEGIN("service_job");
+        long long n = header[HDR_N];
+
+        // Near-equal blocks; the first n % npes ranks take one extra key
+        for (int r = 0; r < npes; r++) {
+            counts[r] = n / npes + (r < n % npes ? 1 : 0);
+            displs[r] = r == 0 ? 0 : displs[r - 1] + counts[r - 1];
+        }
+        long long nlocal = counts[myrank];
+        local_keys.resize(nlocal);
+
+        double t_start = MPI_Wtime();
+        comm_trace_phase("service_scatter");
+        CALI_MARK_BEGIN("comm");
+        CALI_MARK_BEGIN("comm_large");
+        large_Scatterv(job_keys.data(), counts.data(), displs.data(), local_keys.data(), nlocal, MPI_INT, 0, comm);
+        CALI_MARK_END("comm_large");
+        CALI_MARK_END("comm");
+
+        double t_sort = MPI_Wtime();
+        long long nsorted;
+        int* sorted = SampleSortLocal(nlocal, local_keys.data(), &nsorted, buf, comm);
+        double t_sorted = MPI_Wtime();
+
+        // Return the result to rank 0, in rank order
+        comm_trace_phase("service_gather");
+        CALI_MARK_BEGIN("comm");
+        CALI_MARK_BEGIN("comm_large");
+        trace_Gather(&nsorted, 1, MPI_LONG_LONG, sorted_counts.data(), 1, MPI_LONG_LONG, 0, comm);
+        if (myrank == 0) {
+            for (int r = 0; r < npes; r++)
+                sorted_displs[r] = r == 0 ? 0 : sorted_displs[r - 1] + sorted_counts[r - 1];
+        }
+        large_Gatherv(sorted, nsorted, job_keys.data(), sorted_counts.data(), sorted_displs.data(), MPI_INT, 0, comm);
+        CALI_MARK_END("comm_large");
+        CALI_MARK_END("comm");
+        double t_gathered = MPI_Wtime();
+
+        if (myrank == 0) {
+            std::string base = job.substr(0, job.size() - 4);
+            if (!write_keys(queue_dir + "/" + base + ".sorted", job_keys.data(), n))
+                std::cerr << "Could not write result for " << job << std::endl;
+            remove((queue_dir + "/" + job).c_str());
+
+            double t_done = MPI_Wtime();
+            double latency = t_done - t_pickup;
+            busy += latency;
+            max_latency = std::max(max_latency, latency);
+            std::cout << "job " << base << ": n=" << n
+                      << " latency " << latency * 1e3 << " ms"
+                      << " (read " << (t_start - t_pickup) * 1e3
+                      << ", scatter " << (t_sort - t_start) * 1e3
+                      << ", sort " << (t_sorted - t_sort) * 1e3
+                      << ", gather " << (t_gathered - t_sorted) * 1e3
+                      << ", write " << (t_done - t_gathered) * 1e3 << " ms)" << std::endl;
+        }
+        CALI_MARK_END("service_job");
+
+        jobs++;
+        total_keys += n;
+    }
+
+    double t_end = MPI_Wtime();
+    if (myrank == 0) {
+        double wall = t_end - t_ready;
+        std::cout << "Sort service stopped after " << jobs << " jobs, " << total_keys << " keys" << std::endl;
+        if (jobs > 0) {
+            std::cout << "  mean latency " << busy / jobs * 1e3 << " ms, max " << max_latency * 1e3 << " ms" << std::endl;
+            std::cout << "  throughput " << jobs / busy << " jobs/s, " << total_keys / busy
+                      << " keys/s while busy (" << jobs / wall << " jobs/s over " << wall << " s uptime)" << std::endl;
+        }
+        std::cout << "  one-time setup after MPI_Init " << (t_ready - t_launch) * 1e3 << " ms" << std::endl;
+    }
+
+    adiak::value("jobs", jobs);
+    adiak::value("total_keys", total_keys);
+
+    for (size_t i = 0; i < header_reqs.size(); i++)
+        MPI_Request_free(&header_reqs[i]);
+
+    comm_trace_finalize();
+    arena_finalize(comm);
+    run_codec_finalize(comm);
+    MPI_Comm_free(&comm);
+
+    adiak::fini();
+    mgr.stop();
+    mgr.flush();
+
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,192 @@
+/******************************************************************************
+ * FILE: sorted_index.cpp
+ * DESCRIPTION:
+ *   Driver for the distributed sorted-array index (sorted_index.h) with
+ *   Caliper instrumentation. Sorts random data with SampleSort, indexes the
+ *   distributed result with its splitters, runs batches of lower_bound,
+ *   lookup and range queries from every rank and checks every answer against
+ *   global counts.
+ *
+ *   Usage: mpirun -np <p> ./sorted_index <n> [queries per rank] [fence stride]
+ ******************************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+#include <cstdlib>
+#include <caliper/cali.h>
+#include <caliper/cali-manager.h>
+#include <climits>
+#include "comm_trace.h"
+#include "sample_sort.h"
+#include "sorted_index.h"
+
+// Number of keys below each of keys, over all ranks' sorted blocks
+void global_count_below(const int* sorted, long long nlocal, const std::vector<int>& keys,
+                        std::vector<long long>& below) {
+    std::vector<long long> local(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        local[i] = std::lower_bound(sorted, sorted + nlocal, keys[i]) - sorted;
+    below.resize(keys.size());
+    MPI_Allreduce(local.data(), below.data(), (int)keys.size(), MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+}
+
+int main(int argc, char* argv[]) {
+    CALI_CXX_MARK_FUNCTION;
+    int npes, myrank;
+    long long n, nlocal, nq = 1000, fence_stride = 64;
+    double stime, etime;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &npes);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+
+    cali::ConfigManager mgr;
+    mgr.start();
+
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
+    if (argc < 2) {
+        if (myrank == 0) {
+            std::cout << "Usage: mpiexec -n <p> " << argv[0] << " <n> [queries per rank] [fence stride]" << std::endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    n = atoll(argv[1]);
+    if (argc >= 3)
+        nq = atoll(argv[2]);
+    if (argc >= 4)
+        fence_stride = atoll(argv[3]);
+    nlocal = n / npes;
+    n = nlocal * npes;
+
+    int* elmnts = new int[nlocal > 0 ? nlocal : 1];
+    CALI_MARK_BEGIN("data_init_runtime");
+    srand(myrank);
+    for (long long i = 0; i < nlocal; i++) {
+        elmnts[i] = rand() % (10 * n + 1);
+    }
+    CALI_MARK_END("data_init_runtime");
+
+    // The sorted blocks stay where SampleSort left them
+    SampleSortBuffers buf;
+    long long nsorted;
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    int* sorted = SampleSortLocal(nlocal, elmnts, &nsorted, buf, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    etime = MPI_Wtime();
+    double sort_time = etime - stime;
+
+    SortedIndex idx;
+    stime = MPI_Wtime();
+    CALI_MARK_BEGIN("index_build");
+    sorted_index_build(idx, sorted, nsorted, MPI_COMM_WORLD, buf.splitters.data(), fence_stride);
+    CALI_MARK_END("index_build");
+    etime = MPI_Wtime();
+    double build_time = etime - stime;
+
+    // Half the point queries hit stored keys, half are random
+    std::vector<int> keys(nq), los(nq), his(nq);
+    srand(myrank + 1000);
+    for (long long i = 0; i < nq; i++) {
+        keys[i] = i % 2 == 0 && nlocal > 0 ? elmnts[rand() % nlocal] : rand() % (10 * n + 2);
+        los[i] = rand() % (10 * n + 1);
+        his[i] = los[i] + rand() % 1000;
+    }
+
+    std::vector<long long> lb(nq), found(nq), offsets;
+    std::vector<int> range_keys;
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    CALI_MARK_BEGIN("index_lower_bound");
+    sorted_index_lower_bound(idx, keys.data(), nq, lb.data());
+    CALI_MARK_END("index_lower_bound");
+    etime = MPI_Wtime();
+    double lower_bound_time = etime - stime;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    CALI_MARK_BEGIN("index_lookup");
+    sorted_index_lookup(idx, keys.data(), nq, found.data());
+    CALI_MARK_END("index_lookup");
+    etime = MPI_Wtime();
+    double lookup_time = etime - stime;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    CALI_MARK_BEGIN("index_range");
+    sorted_index_range(idx, los.data(), his.data(), nq, offsets, range_keys);
+    CALI_MARK_END("index_range");
+    etime = MPI_Wtime();
+    double range_time = etime - stime;
+
+    // Every rank checks the answers of every rank against global counts
+    CALI_MARK_BEGIN("correctness_check");
+    std::vector<int> all_keys(nq * npes), all_next(nq * npes), all_los(nq * npes), all_his(nq * npes);
+    MPI_Allgather(keys.data(), (int)nq, MPI_INT, all_keys.data(), (int)nq, MPI_INT, MPI_COMM_WORLD);
+    MPI_Allgather(los.data(), (int)nq, MPI_INT, all_los.data(), (int)nq, MPI_INT, MPI_COMM_WORLD);
+    MPI_Allgather(his.data(), (int)nq, MPI_INT, all_his.data(), (int)nq, MPI_INT, MPI_COMM_WORLD);
+    for (long long i = 0; i < nq * npes; i++)
+        all_next[i] = all_keys[i] + 1;
+    std::vector<long long> below, below_next, below_lo, below_hi;
+    global_count_below(sorted, nsorted, all_keys, below);
+    global_count_below(sorted, nsorted, all_next, below_next);
+    global_count_below(sorted, nsorted, all_los, below_lo);
+    global_count_below(sorted, nsorted, all_his, below_hi);
+
+    bool ok = true;
+    long long hits = 0, range_total = 0;
+    for (long long i = 0; i < nq; i++) {
+        long long g = myrank * nq + i;
+        if (lb[i] != below[g])
+            ok = false;
+        long long expect = below_next[g] > below[g] ? below[g] : -1;
+        if (found[i] != expect)
+            ok = false;
+        hits += found[i] >= 0;
+        long long count = offsets[i + 1] - offsets[i];
+        if (count != below_hi[g] - below_lo[g])
+            ok = false;
+        for (long long k = offsets[i]; k < offsets[i + 1]; k++)
+            if (range_keys[k] < los[i] || range_keys[k] >= his[i] || (k > offsets[i] && range_keys[k] < range_keys[k - 1]))
+                ok = false;
+        range_total += count;
+    }
+    int local_ok = ok, all_ok;
+    MPI_Allreduce(&local_ok, &all_ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    long long totals[2] = {hits, range_total}, global_totals[2];
+    MPI_Reduce(totals, global_totals, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    CALI_MARK_END("correctness_check");
+
+    if (myrank == 0) {
+        std::cout << "Queries: " << nq << " per rank, fence stride " << fence_stride << std::endl;
+        std::cout << "Lookups found: " << global_totals[0] << " of " << nq * npes << std::endl;
+        std::cout << "Keys returned by range queries: " << global_totals[1] << std::endl;
+        std::cout << "Are the answers valid? " << (all_ok ? "Yes" : "No") << std::endl;
+        std::cout << "SampleSort time: " << sort_time << " sec" << std::endl;
+        std::cout << "Index build time: " << build_time << " sec" << std::endl;
+        std::cout << "Lower bound time: " << lower_bound_time << " sec" << std::endl;
+        std::cout << "Lookup time: " << lookup_time << " sec" << std::endl;
+        std::cout << "Range time: " << range_time << " sec" << std::endl;
+    }
+
+    delete[] elmnts;
+
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+    run_codec_finalize(MPI_COMM_WORLD);
+
+    mgr.stop();
+    mgr.flush();
+
+    MPI_Finalize();
+
+    return 0;
+}
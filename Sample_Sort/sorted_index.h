@@ -0,0 +1,344 @@
+/******************************************************************************
+ * FILE: sorted_index.h
+ * DESCRIPTION:
+ *   Global index over a distributed sorted array, so sorted output can be
+ *   queried in place instead of being gathered.
+ *
+ *   Every rank keeps the key range of every rank ([first, last] per rank,
+ *   taken from the SampleSort splitters or from one Allgather of the block
+ *   ends) and the global index of each rank's first element. A batch of
+ *   queries is routed to the owning ranks by binary search in that table,
+ *   exchanged with one Alltoallv, answered locally and sent back, so a query
+ *   costs O(log p + log(n/p)) comparisons plus its share of two exchanges.
+ *
+ *   With a fence stride, every stride-th local key is copied into a fence
+ *   array; local searches run on the (cache resident) fences first and then
+ *   within one block of the data.
+ *
+ *   All query functions are collective; ranks may pass different numbers of
+ *   queries (including none).
+ ******************************************************************************/
+
+#ifndef SORTED_INDEX_H
+#define SORTED_INDEX_H
+
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <mpi.h>
+#include <caliper/cali.h>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "buffer_arena.h"
+
+struct SortedIndex {
+    MPI_Comm comm;
+    const int* data;               // local sorted block, not owned
+    long long nlocal;
+    long long first_index;         // global index of data[0]
+    long long n;                   // elements on all ranks
+    std::vector<long long> first;  // per rank, no key below first[r] lives on r or later
+    std::vector<long long> last;   // per rank, no key above last[r] lives on r or earlier
+    std::vector<int> fences;       // data[0], data[stride], ...
+    long long fence_stride;        // 0: no fences
+};
+
+// Collective. data must stay valid (and unchanged) while the index is used.
+// splitters, if given, are the npes SampleSort splitters the block was
+// partitioned with (SampleSortBuffers::splitters); otherwise the key ranges
+// are taken from the blocks themselves, so any globally sorted distribution
+// can be indexed.
+inline void sorted_index_build(SortedIndex& idx, const int* data, long long nlocal, MPI_Comm comm,
+                               const int* splitters = NULL, long long fence_stride = 0) {
+    int npes;
+    MPI_Comm_size(comm, &npes);
+    idx.comm = comm;
+    idx.data = data;
+    idx.nlocal = nlocal;
+    idx.first.assign(npes, 0);
+    idx.last.assign(npes, 0);
+
+    comm_trace_phase("index_build");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    long long before = 0;
+    trace_Exscan(&nlocal, &before, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    trace_Allreduce(&nlocal, &idx.n, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (splitters == NULL) {
+        // Empty blocks get an empty range: first after last
+        long long ends[2] = {nlocal > 0 ? data[0] : LLONG_MAX, nlocal > 0 ? data[nlocal - 1] : LLONG_MIN};
+        std::vector<long long> all_ends(2 * npes);
+        trace_Allgather(ends, 2, MPI_LONG_LONG, all_ends.data(), 2, MPI_LONG_LONG, comm);
+        for (int r = 0; r < npes; r++) {
+            idx.first[r] = all_ends[2 * r];
+            idx.last[r] = all_ends[2 * r + 1];
+        }
+    }
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+    int myrank;
+    MPI_Comm_rank(comm, &myrank);
+    idx.first_index = myrank == 0 ? 0 : before;
+
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    if (splitters != NULL) {
+        // Bucket r holds splitters[r-1] <= key < splitters[r]; the last
+        // bucket also takes INT_MAX
+        for (int r = 0; r < npes; r++) {
+            idx.first[r] = r == 0 ? LLONG_MIN : splitters[r - 1];
+            idx.last[r] = r == npes - 1 ? LLONG_MAX : (long long)splitters[r] - 1;
+        }
+    } else {
+        // Make both tables non-decreasing across empty blocks so they can be
+        // binary searched: an empty block inherits last from the left and
+        // first from the right
+        for (int r = 1; r < npes; r++)
+            idx.last[r] = std::max(idx.last[r], idx.last[r - 1]);
+        for (int r = npes - 2; r >= 0; r--)
+            idx.first[r] = std::min(idx.first[r], idx.first[r + 1]);
+    }
+
+    idx.fence_stride = fence_stride > 0 ? fence_stride : 0;
+    idx.fences.clear();
+    if (idx.fence_stride > 0)
+        for (long long i = 0; i < nlocal; i += idx.fence_stride)
+            idx.fences.push_back(data[i]);
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+}
+
+// First rank whose block may hold a key >= key; npes if none does
+inline int sorted_index_owner(const SortedIndex& idx, long long key) {
+    return (int)(std::lower_bound(idx.last.begin(), idx.last.end(), key) - idx.last.begin());
+}
+
+// Local position of the first key >= key
+inline long long sorted_index_local_lower_bound(const SortedIndex& idx, long long key) {
+    long long lo = 0, hi = idx.nlocal;
+    if (!idx.fences.empty()) {
+        // fences[j - 1] < key <= fences[j]: the answer is in block j - 1 or
+        // at its end
+        long long j = std::lower_bound(idx.fences.begin(), idx.fences.end(), key) - idx.fences.begin();
+        lo = j > 0 ? (j - 1) * idx.fence_stride : 0;
+        hi = std::min(j * idx.fence_stride, idx.nlocal);
+    }
+    return std::lower_bound(idx.data + lo, idx.data + hi, key) - idx.data;
+}
+
+// Routes nq point queries to their owners and returns the global lower bound
+// of each (exact: the global index of the first equal key, or -1)
+inline void sorted_index_point_queries(const SortedIndex& idx, const int* keys, long long nq, long long* out,
+                                       bool exact) {
+    int npes;
+    MPI_Comm_size(idx.comm, &npes);
+
+    // Group the queries by owner; keys past every block are answered here
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    std::vector<int> owner(nq);
+    arena_vector<long long> scounts(npes, 0), sdispls(npes, 0), rcounts(npes), rdispls(npes, 0);
+    for (long long i = 0; i < nq; i++) {
+        owner[i] = sorted_index_owner(idx, keys[i]);
+        if (owner[i] == npes)
+            out[i] = exact ? -1 : idx.n;
+        else
+            scounts[owner[i]]++;
+    }
+    for (int r = 1; r < npes; r++)
+        sdispls[r] = sdispls[r - 1] + scounts[r - 1];
+    long long nsend = sdispls[npes - 1] + scounts[npes - 1];
+    arena_vector<int> send_keys(nsend);
+    arena_vector<long long> order(nsend);
+    std::vector<long long> fill(sdispls.begin(), sdispls.end());
+    for (long long i = 0; i < nq; i++) {
+        if (owner[i] == npes)
+            continue;
+        long long slot = fill[owner[i]]++;
+        send_keys[slot] = keys[i];
+        order[slot] = i;
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    comm_trace_phase("index_route");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Alltoall(scounts.data(), 1, MPI_LONG_LONG, rcounts.data(), 1, MPI_LONG_LONG, idx.comm);
+    for (int r = 1; r < npes; r++)
+        rdispls[r] = rdispls[r - 1] + rcounts[r - 1];
+    long long nrecv = rdispls[npes - 1] + rcounts[npes - 1];
+    arena_vector<int> recv_keys(nrecv);
+    large_Alltoallv(send_keys.data(), scounts.data(), sdispls.data(), recv_keys.data(), rcounts.data(),
+                    rdispls.data(), MPI_INT, idx.comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    arena_vector<long long> answers(nrecv);
+    for (long long i = 0; i < nrecv; i++) {
+        long long pos = sorted_index_local_lower_bound(idx, recv_keys[i]);
+        if (exact)
+            answers[i] = pos < idx.nlocal && idx.data[pos] == recv_keys[i] ? idx.first_index + pos : -1;
+        else
+            answers[i] = idx.first_index + pos;
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    comm_trace_phase("index_reply");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    arena_vector<long long> replies(nsend);
+    large_Alltoallv(answers.data(), rcounts.data(), rdispls.data(), replies.data(), scounts.data(), sdispls.data(),
+                    MPI_LONG_LONG, idx.comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    for (long long s = 0; s < nsend; s++)
+        out[order[s]] = replies[s];
+}
+
+// Global index of the first key >= keys[i], n if there is none
+inline void sorted_index_lower_bound(const SortedIndex& idx, const int* keys, long long nq, long long* out) {
+    sorted_index_point_queries(idx, keys, nq, out, false);
+}
+
+// Global index of the first key equal to keys[i], -1 if it is absent
+inline void sorted_index_lookup(const SortedIndex& idx, const int* keys, long long nq, long long* out) {
+    sorted_index_point_queries(idx, keys, nq, out, true);
+}
+
+// All keys in [los[i], his[i]) for each query, in order. offsets gets nq + 1
+// entries; the keys of query i are keys[offsets[i] .. offsets[i + 1]).
+inline void sorted_index_range(const SortedIndex& idx, const int* los, const int* his, long long nq,
+                               std::vector<long long>& offsets, std::vector<int>& keys) {
+    int npes;
+    MPI_Comm_size(idx.comm, &npes);
+
+    // A query goes to every rank whose block can overlap [lo, hi): from the
+    // first block reaching lo up to, excluding, the first starting at hi
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    std::vector<int> from(nq), to(nq);
+    arena_vector<long long> scounts(npes, 0), sdispls(npes, 0), rcounts(npes), rdispls(npes, 0);
+    for (long long i = 0; i < nq; i++) {
+        from[i] = sorted_index_owner(idx, los[i]);
+        to[i] = los[i] < his[i] ? (int)(std::lower_bound(idx.first.begin(), idx.first.end(), (long long)his[i]) -
+                                         idx.first.begin())
+                                : from[i];
+        to[i] = std::max(to[i], from[i]);
+        for (int r = from[i]; r < to[i]; r++)
+            scounts[r] += 2;
+    }
+    for (int r = 1; r < npes; r++)
+        sdispls[r] = sdispls[r - 1] + scounts[r - 1];
+    long long nsend = sdispls[npes - 1] + scounts[npes - 1];
+    arena_vector<int> send_bounds(nsend);
+    std::vector<long long> fill(sdispls.begin(), sdispls.end());
+    for (long long i = 0; i < nq; i++) {
+        for (int r = from[i]; r < to[i]; r++) {
+            send_bounds[fill[r]++] = los[i];
+            send_bounds[fill[r]++] = his[i];
+        }
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    comm_trace_phase("index_route");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Alltoall(scounts.data(), 1, MPI_LONG_LONG, rcounts.data(), 1, MPI_LONG_LONG, idx.comm);
+    for (int r = 1; r < npes; r++)
+        rdispls[r] = rdispls[r - 1] + rcounts[r - 1];
+    long long nrecv = rdispls[npes - 1] + rcounts[npes - 1];
+    arena_vector<int> recv_bounds(nrecv);
+    large_Alltoallv(send_bounds.data(), scounts.data(), sdispls.data(), recv_bounds.data(), rcounts.data(),
+                    rdispls.data(), MPI_INT, idx.comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    // Local slice of every received query; the reply to a rank is the slice
+    // sizes (one per query) followed by the keys
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    arena_vector<long long> slice_start(nrecv / 2), slice_count(nrecv / 2);
+    arena_vector<long long> kcounts(npes, 0), kdispls(npes, 0);
+    for (int r = 0; r < npes; r++) {
+        for (long long q = rdispls[r] / 2; q < (rdispls[r] + rcounts[r]) / 2; q++) {
+            long long lo = sorted_index_local_lower_bound(idx, recv_bounds[2 * q]);
+            long long hi = std::max(lo, sorted_index_local_lower_bound(idx, recv_bounds[2 * q + 1]));
+            slice_start[q] = lo;
+            slice_count[q] = hi - lo;
+            kcounts[r] += hi - lo;
+        }
+    }
+    for (int r = 1; r < npes; r++)
+        kdispls[r] = kdispls[r - 1] + kcounts[r - 1];
+    arena_vector<int> reply_keys(kdispls[npes - 1] + kcounts[npes - 1]);
+    for (long long q = 0, k = 0; q < nrecv / 2; q++) {
+        std::copy(idx.data + slice_start[q], idx.data + slice_start[q] + slice_count[q], reply_keys.begin() + k);
+        k += slice_count[q];
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    comm_trace_phase("index_reply");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_large");
+    // Slice sizes travel with the same layout as the queries, halved
+    arena_vector<long long> qscounts(npes), qsdispls(npes), qrcounts(npes), qrdispls(npes);
+    for (int r = 0; r < npes; r++) {
+        qscounts[r] = rcounts[r] / 2;
+        qsdispls[r] = rdispls[r] / 2;
+        qrcounts[r] = scounts[r] / 2;
+        qrdispls[r] = sdispls[r] / 2;
+    }
+    arena_vector<long long> piece(nsend / 2);
+    large_Alltoallv(slice_count.data(), qscounts.data(), qsdispls.data(), piece.data(), qrcounts.data(),
+                    qrdispls.data(), MPI_LONG_LONG, idx.comm);
+    arena_vector<long long> gcounts(npes, 0), gdispls(npes, 0);
+    for (int r = 0; r < npes; r++)
+        for (long long s = qrdispls[r]; s < qrdispls[r] + qrcounts[r]; s++)
+            gcounts[r] += piece[s];
+    for (int r = 1; r < npes; r++)
+        gdispls[r] = gdispls[r - 1] + gcounts[r - 1];
+    arena_vector<int> got(gdispls[npes - 1] + gcounts[npes - 1]);
+    large_Alltoallv(reply_keys.data(), kcounts.data(), kdispls.data(), got.data(), gcounts.data(), gdispls.data(),
+                    MPI_INT, idx.comm);
+    CALI_MARK_END("comm_large");
+    CALI_MARK_END("comm");
+
+    // Pieces from each rank arrive in query order; a query's pieces are
+    // appended in rank order, which is key order
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    offsets.assign(nq + 1, 0);
+    std::vector<long long> slot(npes);
+    for (int r = 0; r < npes; r++)
+        slot[r] = qrdispls[r];
+    for (long long i = 0; i < nq; i++) {
+        long long total = 0;
+        for (int r = from[i]; r < to[i]; r++)
+            total += piece[slot[r]++];
+        offsets[i + 1] = offsets[i] + total;
+    }
+    keys.resize(offsets[nq]);
+    std::vector<long long> src(gdispls.begin(), gdispls.end());
+    for (int r = 0; r < npes; r++)
+        slot[r] = qrdispls[r];
+    for (long long i = 0; i < nq; i++) {
+        long long k = offsets[i];
+        for (int r = from[i]; r < to[i]; r++) {
+            long long count = piece[slot[r]++];
+            std::copy(got.begin() + src[r], got.begin() + src[r] + count, keys.begin() + k);
+            src[r] += count;
+            k += count;
+        }
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+}
+
+#endif
@@ -0,0 +1,165 @@
+/******************************************************************************
+ * FILE: string_sort.cpp
+ * DESCRIPTION:
+ *   Driver for the string sample sort (string_sort.h) with Caliper
+ *   instrumentation. Generates variable-length string keys, sorts them with
+ *   the LCP-aware StringSort, checks the global order and the LCP arrays, and
+ *   times the same pipeline with plain std::sort/strcmp for comparison.
+ *
+ *   Input types:
+ *     urls    - URL-like keys sharing long prefixes (the default)
+ *     random  - random lowercase strings of 8 to 32 characters
+ *
+ *   Usage: mpirun -np <p> ./string_sort <n> [urls|random]
+ ******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <mpi.h>
+#include <cstdlib>
+#include <caliper/cali.h>
+#include <caliper/cali-manager.h>
+#include "comm_trace.h"
+#include "string_sort.h"
+
+void fill_strings(StringArray& a, long long nlocal, const std::string& input_type) {
+    static const char* sections[] = {"catalog/products", "catalog/archive", "support/articles", "users/profiles"};
+    char buf[160];
+    for (long long i = 0; i < nlocal; i++) {
+        if (input_type == "random") {
+            int len = 8 + rand() % 25;
+            for (int c = 0; c < len; c++)
+                buf[c] = (char)('a' + rand() % 26);
+            a.push(buf, len);
+        } else {
+            int len = snprintf(buf, sizeof(buf), "https://www.example.com/%s/region-%02d/item-%08d", sections[rand() % 4],
+                               rand() % 16, rand() % 100000000);
+            a.push(buf, len);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    CALI_CXX_MARK_FUNCTION;
+    int npes, myrank;
+    long long n, nlocal;
+    std::string input_type = "urls";
+    double stime, etime;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &npes);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+
+    cali::ConfigManager mgr;
+    mgr.start();
+
+    // Optional communication matrix tracing (SORT_COMM_TRACE=<prefix>)
+    comm_trace_init(MPI_COMM_WORLD);
+
+    // Pooled scratch buffers (SORT_ARENA_HUGEPAGES, SORT_ARENA_FIRST_TOUCH)
+    arena_init();
+
+    if (argc < 2) {
+        if (myrank == 0) {
+            std::cout << "Usage: mpiexec -n <p> " << argv[0] << " <n> [urls|random]" << std::endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    n = atoll(argv[1]);
+    if (argc >= 3)
+        input_type = argv[2];
+    nlocal = n / npes;
+
+    CALI_MARK_BEGIN("data_init_runtime");
+    StringArray input;
+    srand(myrank + 1);
+    fill_strings(input, nlocal, input_type);
+    CALI_MARK_END("data_init_runtime");
+
+    StringArray sorted;
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    CALI_MARK_BEGIN("string_sort");
+    StringSort(input, sorted, MPI_COMM_WORLD);
+    CALI_MARK_END("string_sort");
+    MPI_Barrier(MPI_COMM_WORLD);
+    etime = MPI_Wtime();
+    double lcp_time = etime - stime;
+
+    CALI_MARK_BEGIN("correctness_check");
+    // Local order and LCP values, then order across each rank boundary
+    long long nsorted = sorted.size();
+    int local_ok = 1;
+    for (long long i = 0; i < nsorted && local_ok; i++) {
+        StringKey s = (StringKey)sorted.at(i);
+        if (i == 0)
+            local_ok = sorted.lcp[0] == 0;
+        else
+            local_ok = strcmp(sorted.at(i - 1), sorted.at(i)) <= 0 &&
+                       sorted.lcp[i] == string_lcp((StringKey)sorted.at(i - 1), s, 0);
+    }
+    // Pass the last string to the next rank (empty ranks pass on what they got)
+    std::string prev_last;
+    for (int r = 0; r + 1 < npes; r++) {
+        if (myrank == r) {
+            std::string last = nsorted > 0 ? std::string(sorted.at(nsorted - 1)) : prev_last;
+            int len = (int)last.size() + 1;
+            MPI_Send(&len, 1, MPI_INT, r + 1, 0, MPI_COMM_WORLD);
+            MPI_Send(last.c_str(), len, MPI_CHAR, r + 1, 0, MPI_COMM_WORLD);
+        } else if (myrank == r + 1) {
+            int len;
+            MPI_Recv(&len, 1, MPI_INT, r, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            std::vector<char> last(len);
+            MPI_Recv(last.data(), len, MPI_CHAR, r, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            prev_last = last.data();
+        }
+    }
+    if (myrank > 0 && nsorted > 0 && strcmp(prev_last.c_str(), sorted.at(0)) > 0)
+        local_ok = 0;
+    int all_ok;
+    long long total_sorted;
+    MPI_Reduce(&local_ok, &all_ok, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&nsorted, &total_sorted, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    CALI_MARK_END("correctness_check");
+
+    // Same pipeline with std::sort and strcmp at both sort steps
+    StringArray naive_sorted;
+    MPI_Barrier(MPI_COMM_WORLD);
+    stime = MPI_Wtime();
+    CALI_MARK_BEGIN("string_sort_naive");
+    StringSort(input, naive_sorted, MPI_COMM_WORLD, true);
+    CALI_MARK_END("string_sort_naive");
+    MPI_Barrier(MPI_COMM_WORLD);
+    etime = MPI_Wtime();
+    double naive_time = etime - stime;
+
+    // Average LCP: the characters a plain comparison re-reads per step
+    long long lcp_sum = 0, total_lcp;
+    for (long long i = 0; i < nsorted; i++)
+        lcp_sum += sorted.lcp[i];
+    MPI_Reduce(&lcp_sum, &total_lcp, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (myrank == 0) {
+        std::cout << "Total sorted strings: " << total_sorted << std::endl;
+        std::cout << "Expected sorted strings: " << nlocal * npes << std::endl;
+        std::cout << "Is the sorted array valid? " << (all_ok ? "Yes" : "No") << std::endl;
+        std::cout << "Average LCP: " << (total_sorted > 0 ? (double)total_lcp / total_sorted : 0.0) << " characters"
+                  << std::endl;
+        std::cout << "String sort time: " << lcp_time << " sec" << std::endl;
+        std::cout << "Naive string sort time: " << naive_time << " sec" << std::endl;
+    }
+
+    comm_trace_finalize();
+    arena_finalize(MPI_COMM_WORLD);
+
+    mgr.stop();
+    mgr.flush();
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+/******************************************************************************
+ * FILE: string_sort.h
+ * DESCRIPTION:
+ *   Sample sort for variable-length string keys.
+ *
+ *   Strings travel as one packed character buffer (each string NUL
+ *   terminated) plus per-string counts, so a bucket is one contiguous block
+ *   in the Alltoallv. Comparisons never restart at the first character when
+ *   a common prefix is already known:
+ *     - the local sort is multikey quicksort, which partitions on one
+ *       character at a time and only moves deeper within the equal part;
+ *     - every sorted run carries its LCP array (common prefix length with
+ *       the previous string), which is sent along with the bucket;
+ *     - the received runs are merged pairwise with an LCP merge, which
+ *       decides most steps from the LCP values alone and compares
+ *       characters only past the common prefix.
+ *   Splitters are regularly spaced strings of the sorted local samples, as
+ *   in SampleSort.
+ *
+ *   Strings may not contain NUL characters.
+ ******************************************************************************/
+
+#ifndef STRING_SORT_H
+#define STRING_SORT_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <mpi.h>
+#include <caliper/cali.h>
+#include "comm_trace.h"
+#include "large_count.h"
+#include "buffer_arena.h"
+
+// Strings below this count are finished with insertion sort
+#define STRING_SORT_INSERTION 16
+
+struct StringArray {
+    arena_vector<char> chars;          // strings back to back, each NUL terminated
+    arena_vector<long long> offsets;   // start of string i in chars, plus chars.size() at the end
+    arena_vector<int> lcp;             // set by StringSort: common prefix with string i - 1
+
+    StringArray() : offsets(1, 0) {}
+    long long size() const { return (long long)offsets.size() - 1; }
+    const char* at(long long i) const { return chars.data() + offsets[i]; }
+    void push(const char* s, size_t len) {
+        chars.insert(chars.end(), s, s + len);
+        chars.push_back('\0');
+        offsets.push_back((long long)chars.size());
+    }
+};
+
+typedef const unsigned char* StringKey;
+
+inline int string_lcp(StringKey a, StringKey b, int from) {
+    int k = from;
+    while (a[k] != 0 && a[k] == b[k])
+        k++;
+    return k;
+}
+
+// Sorts keys[0..n), all sharing their first depth characters
+inline void string_mkqsort(StringKey* keys, long long n, int depth) {
+    while (n > STRING_SORT_INSERTION) {
+        // Median of three on the character at depth
+        int a = keys[0][depth], b = keys[n / 2][depth], c = keys[n - 1][depth];
+        int pivot = std::max(std::min(a, b), std::min(std::max(a, b), c));
+
+        // Three-way partition: [0, lt) < pivot, [lt, gt) == pivot, [gt, n) > pivot
+        long long lt = 0, i = 0, gt = n;
+        while (i < gt) {
+            int ch = keys[i][depth];
+            if (ch < pivot)
+                std::swap(keys[lt++], keys[i++]);
+            else if (ch > pivot)
+                std::swap(keys[i], keys[--gt]);
+            else
+                i++;
+        }
+        string_mkqsort(keys, lt, depth);
+        string_mkqsort(keys + gt, n - gt, depth);
+        // Strings that ended at depth are equal; the rest continue one deeper
+        if (pivot == 0)
+            return;
+        keys += lt;
+        n = gt - lt;
+        depth++;
+    }
+    for (long long i = 1; i < n; i++) {
+        StringKey s = keys[i];
+        long long j = i;
+        while (j > 0 && strcmp((const char*)keys[j - 1] + depth, (const char*)s + depth) > 0) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = s;
+    }
+}
+
+inline void string_lcp_array(const StringKey* keys, long long n, int* lcp) {
+    for (long long i = 0; i < n; i++)
+        lcp[i] = i == 0 ? 0 : string_lcp(keys[i - 1], keys[i], 0);
+}
+
+// Merges sorted runs a and b (with LCP arrays) into out/out_lcp; out_lcp[0]
+// is 0. On equal strings a comes first.
+inline void string_lcp_merge(const StringKey* a, const int* alcp, long long na, const StringKey* b, const int* blcp,
+                             long long nb, StringKey* out, int* out_lcp) {
+    // la, lb: common prefix of the current head of a / b with the last
+    // string written
+    long long i = 0, j = 0, k = 0;
+    int la = 0, lb = 0;
+    while (i < na && j < nb) {
+        if (la > lb) {
+            // a's head shares more with the last output than b's head does,
+            // so it is smaller
+            out_lcp[k] = la;
+            out[k++] = a[i++];
+            if (i < na)
+                la = alcp[i];
+        } else if (lb > la) {
+            out_lcp[k] = lb;
+            out[k++] = b[j++];
+            if (j < nb)
+                lb = blcp[j];
+        } else {
+            // Same known prefix: compare from there
+            int h = string_lcp(a[i], b[j], la);
+            out_lcp[k] = la;
+            if (a[i][h] <= b[j][h]) {
+                out[k++] = a[i++];
+                lb = h;
+                if (i < na)
+                    la = alcp[i];
+            } else {
+                out[k++] = b[j++];
+                la = h;
+                if (j < nb)
+                    lb = blcp[j];
+            }
+        }
+    }
+    for (bool first = true; i < na; i++, first = false) {
+        out_lcp[k] = first ? la : alcp[i];
+        out[k++] = a[i];
+    }
+    for (bool first = true; j < nb; j++, first = false) {
+        out_lcp[k] = first ? lb : blcp[j];
+        out[k++] = b[j];
+    }
+    if (k > 0)
+        out_lcp[0] = 0;
+}
+
+// Sorts the strings in, spread over the ranks, into out: each rank gets a
+// contiguous range of the global order, with its LCP array. With naive set
+// the local sort and the final merge are plain std::sort with strcmp, for
+// comparison.
+inline void StringSort(const StringArray& in, StringArray& out, MPI_Comm comm, bool naive = false) {
+    int npes, myrank;
+    MPI_Comm_size(comm, &npes);
+    MPI_Comm_rank(comm, &myrank);
+    long long nlocal = in.size();
+
+    // Sort local keys (pointers into in.chars)
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_large");
+    arena_vector<StringKey> keys(nlocal);
+    for (long long i = 0; i < nlocal; i++)
+        keys[i] = (StringKey)in.at(i);
+    arena_vector<int> lcp(nlocal);
+    if (naive) {
+        std::sort(keys.begin(), keys.end(),
+                  [](StringKey a, StringKey b) { return strcmp((const char*)a, (const char*)b) < 0; });
+    } else {
+        string_mkqsort(keys.data(), nlocal, 0);
+        string_lcp_array(keys.data(), nlocal, lcp.data());
+    }
+    CALI_MARK_END("comp_large");
+    CALI_MARK_END("comp");
+
+    // npes - 1 regularly spaced samples per rank, packed
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    std::vector<char> samples;
+    int nsamples = 0;
+    for (int i = 1; i < npes && nlocal > 0; i++) {
+        const char* s = (const char*)keys[i * nlocal / npes];
+        samples.insert(samples.end(), s, s + strlen(s) + 1);
+        nsamples++;
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    comm_trace_phase("string_splitters");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    int sample_bytes = (int)samples.size();
+    std::vector<int> byte_counts(npes), byte_displs(npes, 0);
+    trace_Allgather(&sample_bytes, 1, MPI_INT, byte_counts.data(), 1, MPI_INT, comm);
+    for (int r = 1; r < npes; r++)
+        byte_displs[r] = byte_displs[r - 1] + byte_counts[r - 1];
+    std::vector<char> all_samples(byte_displs[npes - 1] + byte_counts[npes - 1] + 1);
+    trace_Allgatherv(samples.data(), sample_bytes, MPI_CHAR, all_samples.data(), byte_counts.data(),
+                     byte_displs.data(), MPI_CHAR, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    // Sort the samples and take every (npes-1)-th as a splitter
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_small");
+    std::vector<StringKey> sample_keys;
+    for (size_t pos = 0; pos + 1 < all_samples.size(); pos += strlen(&all_samples[pos]) + 1)
+        sample_keys.push_back((StringKey)&all_samples[pos]);
+    string_mkqsort(sample_keys.data(), (long long)sample_keys.size(), 0);
+    long long total_samples = (long long)sample_keys.size();
+    std::vector<StringKey> splitters;
+    for (int i = 1; i < npes && total_samples > 0; i++)
+        splitters.push_back(sample_keys[i * total_samples / npes]);
+
+    // Bucket r holds splitters[r-1] <= s < splitters[r]
+    arena_vector<long long> scounts(2 * npes, 0), rcounts(2 * npes);
+    std::vector<long long> bucket_start(npes + 1, nlocal);
+    bucket_start[0] = 0;
+    for (size_t r = 0; r < splitters.size(); r++) {
+        StringKey sp = splitters[r];
+        bucket_start[r + 1] = std::lower_bound(keys.begin() + bucket_start[r], keys.end(), sp,
+                                               [](StringKey a, StringKey b) {
+                                                   return strcmp((const char*)a, (const char*)b) < 0;
+                                               }) - keys.begin();
+    }
+
+    // Pack the buckets in order: characters, and one LCP per string (the
+    // first string of a bucket has no predecessor there). The total size is
+    // known from in.offsets; stpcpy finds each end while copying.
+    arena_raw_vector<char> send_chars(in.offsets[nlocal] - in.offsets[0]);
+    arena_vector<int> send_lcp(nlocal);
+    long long pos = 0;
+    for (int r = 0; r < npes; r++) {
+        long long start_pos = pos;
+        for (long long i = bucket_start[r]; i < bucket_start[r + 1]; i++) {
+            pos = stpcpy(&send_chars[pos], (const char*)keys[i]) - send_chars.data() + 1;
+            send_lcp[i] = i == bucket_start[r] ? 0 : lcp[i];
+        }
+        scounts[2 * r] = bucket_start[r + 1] - bucket_start[r];
+        scounts[2 * r + 1] = pos - start_pos;
+    }
+    CALI_MARK_END("comp_small");
+    CALI_MARK_END("comp");
+
+    comm_trace_phase("string_counts");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_small");
+    trace_Alltoall(scounts.data(), 2, MPI_LONG_LONG, rcounts.data(), 2, MPI_LONG_LONG, comm);
+    CALI_MARK_END("comm_small");
+    CALI_MARK_END("comm");
+
+    arena_vector<long long> sc(npes), sd(npes, 0), rc(npes), rd(npes, 0);
+    arena_vector<long long> sn(npes), snd(npes, 0), rn(npes), rnd(npes, 0);
+    for (int r = 0; r < npes; r++) {
+        sn[r] = scounts[2 * r];
+        sc[r] = scounts[2 * r + 1];
+        rn[r] = rcounts[2 * r];
+        rc[r] = rcounts[2 * r + 1];
+        if (r > 0) {
+            snd[r] = snd[r - 1] + sn[r - 1];
+            sd[r] = sd[r - 1] + sc[r - 1];
+            rnd[r] = rnd[r - 1] + rn[r - 1];
+            rd[r] = rd[r - 1] + rc[r - 1];
+        }
+    }
+    long long nrecv = rnd[npes - 1] + rn[npes - 1];
+    arena_raw_vector<char> recv_chars(rd[npes - 1] + rc[npes - 1]);
+    arena_vector<int> recv_lcp(nrecv);
+
+    comm_trace_phase("string_exchange");
+    CALI_MARK_BEGIN("comm");
+    CALI_MARK_BEGIN("comm_large");
+    large_Alltoallv(send_chars.data(), sc.data(), sd.data(), recv_chars.data(), rc.data(), rd.data(), MPI_CHAR, comm);
+    if (!naive)
+        large_Alltoallv(send_lcp.data(), sn.data(), snd.data(), recv_lcp.data(), rn.data(), rnd.data(), MPI_INT,
+                        comm);
+    CALI_MARK_END("comm_large");
+    CALI_MARK_END("comm");
+
+    // Merge the received runs pairwise, level by level, keeping LCP arrays.
+    // This is the only pass that measures the received strings.
+    CALI_MARK_BEGIN("comp");
+    CALI_MARK_BEGIN("comp_large");
+    arena_vector<StringKey> merged(nrecv), tmp(nrecv);
+    arena_vector<int> merged_lcp(nrecv), tmp_lcp(nrecv);
+    for (long long i = 0, p = 0; i < nrecv; i++) {
+        merged[i] = (StringKey)&recv_chars[p];
+        p += (long long)strlen(&recv_chars[p]) + 1;
+    }
+    if (naive) {
+        std::sort(merged.begin(), merged.end(),
+                  [](StringKey a, StringKey b) { return strcmp((const char*)a, (const char*)b) < 0; });
+    } else {
+        std::copy(recv_lcp.begin(), recv_lcp.end(), merged_lcp.begin());
+        std::vector<long long> bounds(rnd.begin(), rnd.end());
+        bounds.push_back(nrecv);
+        int nruns = npes;
+        while (nruns > 1) {
+            std::vector<long long> next_bounds;
+            for (int r = 0; r < nruns; r += 2) {
+                long long lo = bounds[r], mid = bounds[std::min(r + 1, nruns)], hi = bounds[std::min(r + 2, nruns)];
+                string_lcp_merge(&merged[lo], &merged_lcp[lo], mid - lo, &merged[mid], &merged_lcp[mid], hi - mid,
+                                 &tmp[lo], &tmp_lcp[lo]);
+                next_bounds.push_back(lo);
+            }
+            next_bounds.push_back(nrecv);
+            merged.swap(tmp);
+            merged_lcp.swap(tmp_lcp);
+            bounds.swap(next_bounds);
+            nruns = (int)bounds.size() - 1;
+        }
+    }
+
+    // Pack the result; as on the send side, stpcpy yields each offset
+    out.chars.resize(recv_chars.size());
+    out.offsets.resize(nrecv + 1);
+    out.offsets[0] = 0;
+    for (long long i = 0; i < nrecv; i++)
+        out.offsets[i + 1] = stpcpy(&out.chars[out.offsets[i]], (const char*)merged[i]) - out.chars.data() + 1;
+    out.lcp.resize(nrecv);
+    if (naive)
+        string_lcp_array(merged.data(), nrecv, out.lcp.data());
+    else
+        std::copy(merged_lcp.begin(), merged_lcp.end(), out.lcp.begin());
+    CALI_MARK_END("comp_large");
+    CALI_MARK_END("comp");
+}
+
+#endif